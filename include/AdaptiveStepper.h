@@ -0,0 +1,39 @@
+#ifndef ADAPTIVESTEPPER_H
+#define ADAPTIVESTEPPER_H
+
+#include <vector>
+#include "utils.h"
+
+// Error-controlled integration of the chain, sampled on the uniform grid of dt_ps.
+// The integrator takes its own steps, sized from the difference of the Euler predictor
+// and the Heun corrector, and the spins in between two steps are interpolated.
+class AdaptiveStepper {
+    private:
+        FirstTouchVector<Particle> start; // last two accepted states
+        FirstTouchVector<Particle> end;
+        FirstTouchVector<Vector3> start_derivative;
+        FirstTouchVector<Particle> trial;
+        FirstTouchVector<Vector3> trial_derivative;
+        double start_time = 0.0; // times of the two states from the last output
+        double end_time = 0.0;
+        double output_time = 0.0;
+        float step = 0.0f; // the next step to try
+        // what the steps were taken with, a change restarts the integration from the output
+        bool field_on = false;
+        float damping = 0.0f;
+        float output_dt = 0.0f;
+        bool ready = false;
+        long accepted = 0;
+        long rejected = 0;
+        void restart(const FirstTouchVector<Particle>& particles, Params* params);
+        void take_step(Params* params);
+    public:
+        void reset();
+        void advance(FirstTouchVector<Particle>& particles, Params* params);
+        float relax(FirstTouchVector<Particle>& particles, Params* params);
+        float current_step() const;
+        long steps() const;
+        long rejections() const;
+};
+
+#endif
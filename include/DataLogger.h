@@ -5,15 +5,88 @@
 #include <cstdlib>
 #include <vector>
 #include <string>
+#include <functional>
+#include "SpinWaves.h"
+#include "SnapshotStore.h"
+#include "Dispersion.h"
 
 class DataLogger {
     private:
-        std::vector<float> _data;
-		std::vector<Particle>  start;
+        SnapshotStore _data; // deviations from start, one row of channels * N per snapshot
+        size_t size_hint = 0;
+        std::vector<float> row;
+		FirstTouchVector<Particle>  start;
+
+		// what is recorded of every site
+		int channels = 1; // 1: S_z, 2: the two components across the spin of start, planar rows
+		int n_sites = 0;
+		std::vector<float> frame; // local frame e1, e2 of every site, components in planes of N (e1x, e1y, ..., e2z)
+		std::vector<float> baseline; // the recorded values of start
+		std::vector<float> planar; // rows of a block before they are interleaved
+		void set_layout(Params* params);
+		void set_frame();
+		void load(long first, long count, float* rows);
+		int bins() const;
+		std::vector<SpinWaveMode> overlay_modes;
+		std::string output_dir; // where the csv files go, the working directory if empty
+		std::string output(const char* name);
+
+		// anti-alias filter and decimation of the integrator steps
+		int stride = 1; // integrator steps per snapshot
+		int filter_order = 1;
+		int filter_slots = 1; // snapshots being accumulated at the same time
+		long filter_step = 0;
+		std::vector<float> filter_taps;
+		std::vector<float> filter_acc;
+		void append(const float* values, Params* params);
+		float droop(int t, int T);
+		float droop_angle(double theta);
+
+		// averaging of the spectrum over segments (Welch) and pulses
+		int segment_length = 0; // snapshots per segment, 0 = one transform of the whole recording
+		int segment_hop = 0;
+		long consumed = 0; // snapshots already dropped from the front of _data
+		long next_segment = 0; // first snapshot of the next segment
+		int segments_done = 0;
+		std::vector<float> power_sum;
+		float* segment_in = nullptr;
+		fftwf_complex* segment_out = nullptr;
+		fftwf_plan segment_plan = nullptr;
+		void process_segment(Params* params);
+		void segment_spectrum(std::vector<float>& map, long halo, Params* params);
+		void write_spectrum(const char* path, Params* params);
+
+		// spectrum of a window of (k, energy) only
+		void analyze_zoom(Params* params);
+
+		// transform through a scratch file for recordings larger than the memory
+		typedef std::function<void(long first, long count, float* rows)> RowReader;
+		bool transform_out_of_core(const RowReader& read, long T, Params* params);
+
+		// peaks of every k, written to result_dispersion.csv (Dispersion.h)
+		std::vector<DispersionPeak> peaks;
+		long halo_column(long column) const;
+		long fold_rows(float* map, long T, long row_floats) const;
+		void find_peaks(float* padded, long rows, long cols, long row_floats, bool wrap_rows, float largest,
+		                long first_row, long last_row, long first_column, Params* params);
+		void dispersion_of_spectrum(float* padded, long T, Params* params);
+		void write_dispersion(long wrap_rows, double energy_step, double energy_first, long k_first, Params* params);
     public:
-        DataLogger(int size_hint, std::vector<Particle>& initial_state);
-        void listen(std::vector<float>& data, Params* params);
+        DataLogger(size_t size_hint, FirstTouchVector<Particle>& initial_state);
+        DataLogger(const DataLogger&) = delete;
+        DataLogger& operator=(const DataLogger&) = delete;
+        ~DataLogger();
+        static int recording_stride(Params* params);
+        int plan_recording(Params* params);
+        void record(const Particle* sites, Params* params);
+        bool plan_segments(int length, Params* params);
+        void next_block(FirstTouchVector<Particle>& state);
         void analyze(Params* params);
+        void overlay(const std::vector<SpinWaveMode>& modes);
+        void set_output_dir(const std::string& dir);
+        size_t compressed_slice_bytes() const;
+        bool write_slice(const char* path, long offset, long global_N, size_t position, Params* params);
+        bool analyze_recording(const char* path, Params* params);
 };
 
 #endif
\ No newline at end of file
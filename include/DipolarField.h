@@ -0,0 +1,31 @@
+#ifndef DIPOLARFIELD_H
+#define DIPOLARFIELD_H
+
+#include <fftw3.h>
+#include <vector>
+#include "utils.h"
+
+// Long-range dipolar field of the chain as a convolution with a precomputed kernel.
+// The spins are zero padded to 2N sites so the circular FFT convolution equals the
+// open-boundary sum, and the plans and buffers are kept between steps.
+class DipolarField {
+    private:
+        int N = 0;
+        int n_pad = 0;
+        float* in = nullptr; // x, y and z components, each n_pad long
+        float* out = nullptr;
+        fftwf_complex* spectrum = nullptr;
+        std::vector<float> kernel; // spectrum of 1/|n|^3, real since the kernel is even
+        fftwf_plan forward = nullptr;
+        fftwf_plan backward = nullptr;
+        void release();
+    public:
+        DipolarField() = default;
+        DipolarField(const DipolarField&) = delete;
+        DipolarField& operator=(const DipolarField&) = delete;
+        ~DipolarField();
+        bool resize(int n_of_particles);
+        void compute(const FirstTouchVector<Particle>& particles, Params* params, FirstTouchVector<Vector3>& field);
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef DISPERSION_H
+#define DISPERSION_H
+
+#include <cstddef>
+#include <vector>
+
+// Post-processing of a spectrum map into its dispersion: the magnitudes are smoothed with a
+// separable Gaussian, put on a log scale and every column (one k) is searched for peaks along the
+// rows (energy), each located between the rows by a parabola through its three highest points.
+// Maps are row-major [row][column], rows are energies and columns are k.
+
+// A peak of one column, in bins of the map it was found in
+struct DispersionPeak {
+    long column; // k bin
+    double row; // energy bin, interpolated between the rows
+    double width; // full width at half maximum (rows)
+    float amplitude; // height of the smoothed peak, in the units of the map
+};
+
+std::vector<float> GaussianTaps(float sigma);
+void LogScale(float* values, size_t count, float floor);
+void GaussianSmooth(float* map, long rows, long stride, long cols, bool wrap_rows,
+                    const std::vector<float>& row_taps, const std::vector<float>& col_taps);
+void FindPeaks(const float* map, long rows, long cols, long first_row, long last_row, float threshold,
+               int per_column, std::vector<DispersionPeak>& peaks);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef GROUNDSTATELIBRARY_H
+#define GROUNDSTATELIBRARY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+// Relaxed chains stored on disk, one file per lattice and Hamiltonian
+// (gs_<hash>.bin), so a new run can start next to its ground state
+// instead of from random angles.
+class GroundStateLibrary {
+    private:
+        std::string directory;
+        std::string path(uint64_t key);
+    public:
+        GroundStateLibrary(const std::string& directory);
+        static uint64_t key(Params* params);
+        bool warm_start(FirstTouchVector<Particle>& particles, Params* params);
+        bool store(const FirstTouchVector<Particle>& particles, Params* params);
+};
+
+#endif
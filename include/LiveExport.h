@@ -0,0 +1,33 @@
+#ifndef LIVEEXPORT_H
+#define LIVEEXPORT_H
+
+#include <string>
+#include "utils.h"
+#include "LiveLayout.h"
+
+// Publishes the spins of a running simulation to a POSIX shared-memory ring buffer
+// (layout in LiveLayout.h). Publishing copies the spins into the next slot between two
+// stores of its sequence number. There are no locks or system calls, and readers never
+// hold up the writer: a reader that is too slow finds its frame overwritten and moves on.
+class LiveExport {
+    private:
+        std::string name;
+        int fd = -1;
+        void* base = nullptr;
+        size_t bytes = 0;
+        LiveHeader* header = nullptr;
+        uint64_t frames = 0;
+        double last_time = -1e30; // simulated time of the last published frame
+    public:
+        LiveExport() = default;
+        LiveExport(const LiveExport&) = delete;
+        LiveExport& operator=(const LiveExport&) = delete;
+        ~LiveExport();
+        bool open(const char* name, long n_sites, long first_site, long total_sites, int n_slots, Params* params);
+        void close();
+        bool is_open() const;
+        bool due(double time_ps, Params* params) const;
+        void publish(const Particle* sites, double time_ps, float energy, uint32_t flags, Params* params);
+};
+
+#endif
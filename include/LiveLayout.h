@@ -0,0 +1,69 @@
+#ifndef LIVELAYOUT_H
+#define LIVELAYOUT_H
+
+#include <atomic>
+#include <cstdint>
+
+// Layout of the shared memory a running simulation publishes its spins to (LiveExport.h),
+// shared with the readers (LiveReader.h). It has no dependencies, so outside tools can
+// include it on its own.
+//
+//   [LiveHeader][slot 0][slot 1]...[slot n_slots - 1]
+//   slot: [LiveSlot][n_sites x (S_x, S_y, S_z) float]
+//
+// Frames are numbered from 1 and frame f goes to slot f % n_slots. Every slot is a
+// seqlock: its sequence is 2f - 1 while frame f is written and 2f once it is complete.
+
+#define LIVE_MAGIC 0x4556494cu // "LIVE"
+#define LIVE_VERSION 1
+#define LIVE_DEFAULT_NAME "/spinchain"
+
+// LiveSlot::flags
+#define LIVE_FIELD_ON 1u
+#define LIVE_RELAXING 2u
+
+struct LiveHeader {
+    std::atomic<uint32_t> magic; // written last, readers wait for it
+    uint32_t version;
+    uint64_t n_sites; // sites in every frame
+    uint64_t first_site; // global index of the first site (one segment per MPI rank)
+    uint64_t total_sites; // sites of the whole chain
+    uint32_t n_slots;
+    uint32_t writer_pid;
+    uint64_t slot_bytes; // distance between slots
+    float dt_ps; // step of the integrator when the export was opened
+    float J1;
+    float J2;
+    uint32_t reserved;
+    std::atomic<uint64_t> latest; // newest complete frame, 0 before the first
+    std::atomic<uint32_t> closed; // set when the writer shuts down
+};
+
+struct LiveSlot {
+    std::atomic<uint64_t> sequence;
+    uint64_t frame;
+    uint64_t step; // steps taken by the integrator
+    double time_ps; // simulated time
+    float energy; // total energy (meV), NaN when it was not computed for this frame
+    float magnetization[3]; // mean spin of the sites in the frame
+    float external_field; // mT
+    uint32_t flags;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the seqlock needs lock-free 64-bit atomics");
+
+// bytes from the start of a slot to its spins
+static inline uint64_t LiveSpinOffset() {
+    return (sizeof(LiveSlot) + 63) & ~(uint64_t) 63;
+}
+
+// bytes of one slot with n sites, rounded to cache lines
+static inline uint64_t LiveSlotBytes(uint64_t n_sites) {
+    return (LiveSpinOffset() + n_sites * 3 * sizeof(float) + 63) & ~(uint64_t) 63;
+}
+
+static inline uint64_t LiveHeaderBytes() {
+    return (sizeof(LiveHeader) + 63) & ~(uint64_t) 63;
+}
+
+#endif
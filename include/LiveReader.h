@@ -0,0 +1,44 @@
+#ifndef LIVEREADER_H
+#define LIVEREADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "LiveLayout.h"
+
+// A frame of the live export, read in place. The pointers go straight into the shared
+// memory, so nothing is copied, but the writer may reuse the slot at any time: check
+// LiveReader::valid after using the values and drop them if it returns false.
+struct LiveFrame {
+    uint64_t frame = 0;
+    const LiveSlot* slot = nullptr; // time, step and observables
+    const float* spins = nullptr; // n_sites x (S_x, S_y, S_z)
+};
+
+// Read-only view of the shared memory a simulation publishes to (LiveExport.h).
+// Only needs LiveLayout.h and this file, and never writes to the memory, so any number of
+// readers can watch one run without the writer noticing.
+class LiveReader {
+    private:
+        int fd = -1;
+        const void* base = nullptr;
+        size_t bytes = 0;
+        const LiveHeader* header = nullptr;
+        const LiveSlot* slot_of(uint64_t frame) const;
+        bool view(uint64_t frame, LiveFrame* result) const;
+    public:
+        LiveReader() = default;
+        LiveReader(const LiveReader&) = delete;
+        LiveReader& operator=(const LiveReader&) = delete;
+        ~LiveReader();
+        bool open(const char* name);
+        void close();
+        bool is_open() const;
+        const LiveHeader* info() const;
+        bool writer_alive() const;
+        bool latest(LiveFrame* result) const;
+        bool next(uint64_t after, LiveFrame* result) const;
+        bool valid(const LiveFrame& frame) const;
+        bool copy(const LiveFrame& frame, LiveSlot* observables, float* spins) const;
+};
+
+#endif
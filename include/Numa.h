@@ -0,0 +1,86 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <vector>
+#include <sys/mman.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Linux places a page on the NUMA node of the thread that touches it first. Arrays that are
+// swept by the integrator are therefore zeroed in a parallel loop with the same static
+// partitioning as the sweeps, so every thread finds its part of the chain on its own socket.
+// Together with pinned threads (PinThreads) the sweeps use the memory bandwidth of all sockets.
+
+// arrays at least this large get their own pages from mmap, smaller ones come from new
+#define FIRST_TOUCH_MIN_BYTES (1 << 20)
+
+// thread pinning (Params::affinity)
+enum AffinityPolicy {
+    AFFINITY_NONE = 0, // left to the OS, or to OMP_PROC_BIND / OMP_PLACES when they are set
+    AFFINITY_COMPACT = 1, // thread t on the t-th allowed cpu, filling one socket before the next
+    AFFINITY_SPREAD = 2 // threads dealt out over the NUMA nodes in turn
+};
+
+bool PinThreads(int policy);
+int NumaNodes();
+
+// Allocator that returns zeroed memory, first touched in parallel in schedule(static) chunks
+// of elements. Elements added without a value (resize(n), vector(n)) are not initialized
+// again, so they are zero in new memory and keep their old value when a vector grows back
+// into its capacity.
+template <class T>
+class FirstTouchAllocator {
+    public:
+        typedef T value_type;
+        FirstTouchAllocator() = default;
+        template <class U> FirstTouchAllocator(const FirstTouchAllocator<U>&) {}
+
+        T* allocate(size_t n) {
+            size_t bytes = n * sizeof(T);
+            if (bytes < FIRST_TOUCH_MIN_BYTES) {
+                void* memory = ::operator new(bytes);
+                memset(memory, 0, bytes);
+                return (T*) memory;
+            }
+            void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            char* first = (char*) memory;
+            #pragma omp parallel for schedule(static)
+            for (long i = 0; i < (long) n; i++) {
+                memset(first + i * sizeof(T), 0, sizeof(T));
+            }
+            return (T*) memory;
+        }
+
+        void deallocate(T* memory, size_t n) {
+            size_t bytes = n * sizeof(T);
+            if (bytes < FIRST_TOUCH_MIN_BYTES) {
+                ::operator delete(memory);
+            }
+            else {
+                munmap(memory, bytes);
+            }
+        }
+
+        // default-initialize, which leaves the (already zeroed) memory alone
+        template <class U> void construct(U* p) {
+            ::new ((void*) p) U;
+        }
+        template <class U, class... Args> void construct(U* p, Args&&... args) {
+            ::new ((void*) p) U(static_cast<Args&&>(args)...);
+        }
+
+        template <class U> bool operator==(const FirstTouchAllocator<U>&) const { return true; }
+        template <class U> bool operator!=(const FirstTouchAllocator<U>&) const { return false; }
+};
+
+template <class T>
+using FirstTouchVector = std::vector<T, FirstTouchAllocator<T>>;
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <vector>
+#include "utils.h"
+#include "DataLogger.h"
+
+// The two stages of the GUI without the GUI, for batch runs
+long CoarseToFine(FirstTouchVector<Particle>& particles, Params* params, long max_steps);
+long RelaxGroundState(FirstTouchVector<Particle>& particles, Params* params, long max_steps, bool* converged);
+DataLogger* RecordPulse(FirstTouchVector<Particle>& particles, Params* params);
+float MeasureReflection(const FirstTouchVector<Particle>& ground_state, Params* params, float k0, float* energy);
+
+#endif
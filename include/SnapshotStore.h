@@ -0,0 +1,52 @@
+#ifndef SNAPSHOTSTORE_H
+#define SNAPSHOTSTORE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// how the snapshots of a recording are kept in memory
+enum SnapshotCodec {
+    SNAPSHOT_FLOAT32 = 0, // as recorded
+    SNAPSHOT_INT16 = 1, // integers on a per-snapshot scale (absolute error max|x| / 65534, or the tolerance)
+    SNAPSHOT_FLOAT16 = 2 // half floats of x / max|x| (relative error 2^-11)
+};
+
+// The recorded snapshots, optionally compressed. A compressed snapshot is quantized to 16 bits,
+// delta coded along the chain and Rice coded in independent blocks of sites, so snapshots
+// are encoded and decoded in parallel and any snapshot can be read on its own. The coded
+// snapshots can be written out as they are and decoded from a file with decode_frame.
+class SnapshotStore {
+    private:
+        int codec = SNAPSHOT_FLOAT32;
+        int N = 0; // values per snapshot
+        float tolerance = 0.0f; // largest error of an int16 value, 0 for the finest step of each snapshot
+        std::vector<float> raw; // SNAPSHOT_FLOAT32
+        std::vector<uint8_t> bytes; // compressed snapshots back to back
+        std::vector<size_t> frame_start; // where every snapshot starts in bytes
+        std::vector<std::vector<uint8_t>> block_buffers; // encoder workspace
+        // quantization error of everything pushed so far
+        double error_sq = 0.0;
+        double signal_sq = 0.0;
+        float max_error = 0.0f;
+        long values = 0;
+        void encode(const float* row);
+    public:
+        void configure(int codec, int values_per_snapshot, float tolerance);
+        bool configured() const;
+        bool compressed() const;
+        void reserve(size_t n_of_values);
+        void push(const float* row);
+        long size() const;
+        void read(long t, float* row) const;
+        void read_block(long first, long count, float* rows) const;
+        void drop_front(long count);
+        void clear();
+        size_t memory() const;
+        void report() const;
+        const std::vector<uint8_t>& encoded() const;
+        size_t frame_offset(long t) const;
+        static void decode_frame(int codec, int N, const uint8_t* data, size_t length, float* row);
+};
+
+#endif
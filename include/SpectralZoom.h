@@ -0,0 +1,36 @@
+#ifndef SPECTRALZOOM_H
+#define SPECTRALZOOM_H
+
+#include <fftw3.h>
+#include <vector>
+
+// Chirp-z transform: the DTFT X(theta) = sum_n x_n exp(-i theta n) of a series of n_in samples
+// at n_out equally spaced angles theta_m = theta0 + m dtheta (radians per sample), computed
+// with Bluestein's algorithm as a convolution of two FFTs of length >= n_in + n_out - 1.
+// The band can be any width and start anywhere, so a narrow window of the spectrum is
+// sampled finely without transforming the rest of it.
+class ChirpZ {
+    private:
+        int n_in = 0;
+        int n_out = 0;
+        int L = 0; // length of the convolution
+        std::vector<double> pre; // exp(-i (theta0 n + dtheta n^2 / 2)), re/im interleaved
+        std::vector<double> post; // exp(-i dtheta m^2 / 2)
+        fftwf_complex* kernel = nullptr; // FFT of the chirp exp(i dtheta j^2 / 2), divided by L
+        fftwf_plan forward = nullptr;
+        fftwf_plan backward = nullptr;
+        void release();
+    public:
+        ChirpZ() = default;
+        ChirpZ(const ChirpZ&) = delete;
+        ChirpZ& operator=(const ChirpZ&) = delete;
+        ~ChirpZ();
+        bool plan(int n_in, int n_out, double theta0, double dtheta);
+        int work_size() const;
+        void execute(const fftwf_complex* x, fftwf_complex* X, fftwf_complex* work) const;
+};
+
+bool BurgAR(const fftwf_complex* x, int n, int order, std::vector<double>& a, double* noise);
+double ARPower(const std::vector<double>& a, double noise, double theta);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef SPINWAVES_H
+#define SPINWAVES_H
+
+#include <vector>
+#include "utils.h"
+
+// largest chain HolsteinPrimakoffSpinWaves diagonalizes, its matrices grow as (2N)^2 and the work as N^3
+#define MAX_DIAGONALIZED_SITES 400
+
+// A linear spin-wave mode of the relaxed chain
+struct SpinWaveMode {
+    float k; // wave number (radians per site, 0..pi)
+    float energy; // hbar * omega (meV)
+    float weight; // share of the mode seen in S_z, which is what DataLogger records
+};
+
+double ClassicalPitch(float J1, float J2);
+double SpiralEnergy(double k, double Q, Params* params);
+float SpiralPitch(const FirstTouchVector<Particle>& ground_state, Params* params, float* spread);
+std::vector<SpinWaveMode> AnalyticSpinWaves(float Q, Params* params);
+bool HolsteinPrimakoffSpinWaves(const FirstTouchVector<Particle>& ground_state, Params* params, std::vector<SpinWaveMode>& modes);
+bool LinearSpinWaves(const FirstTouchVector<Particle>& ground_state, Params* params, std::vector<SpinWaveMode>& modes);
+bool WriteSpinWaves(const char* path, const std::vector<SpinWaveMode>& modes, Params* params);
+
+#endif
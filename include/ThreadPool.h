@@ -0,0 +1,43 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool: every worker runs tasks from the back of its own queue and
+// steals from the front of the others when it runs dry. Tasks submitted from inside a
+// task go to the queue of the worker running it.
+class ThreadPool {
+    private:
+        struct Queue {
+            std::mutex lock;
+            std::deque<std::function<void()>> tasks;
+        };
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> threads;
+        std::atomic<long> unfinished{0}; // submitted but not yet finished
+        std::atomic<unsigned> next_queue{0};
+        bool stopping = false;
+        std::mutex sleep_lock;
+        std::condition_variable wake;
+        std::condition_variable done;
+        bool take(int self, std::function<void()>& task);
+        void work(int self);
+    public:
+        ThreadPool(int workers);
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool();
+        void submit(std::function<void()> task);
+        void wait();
+        int size() const;
+        long pending() const;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+#include <math.h>
+#include "raylib.h"
+
+// Counter-based random numbers (Philox4x32-10, Salmon et al. 2011). Every draw is a
+// pure function of (seed, stream, site, step), so threads and ranks need no shared
+// generator state and the numbers don't depend on how the sites are split up.
+
+#define RNG_STREAM_THERMAL 0u
+#define RNG_STREAM_INIT 1u
+
+// ONE PHILOX4x32-10 BLOCK
+// PARAMS: (128-bit counter), (64-bit key), (output words)
+inline void Philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t) 0xD2511F53u * c0;
+        uint64_t p1 = (uint64_t) 0xCD9E8D57u * c2;
+        uint32_t hi0 = (uint32_t) (p0 >> 32), lo0 = (uint32_t) p0;
+        uint32_t hi1 = (uint32_t) (p1 >> 32), lo1 = (uint32_t) p1;
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// THREE INDEPENDENT N(0, 1) NUMBERS FOR A SITE AND STEP
+// PARAMS: (seed), (stream of the draw), (global index of the site), (step)
+// RETURNS: the numbers as the components of a vector
+inline Vector3 PhiloxGaussian3(uint32_t seed, uint32_t stream, uint64_t site, uint64_t step) {
+    uint32_t counter[4] = { (uint32_t) site, (uint32_t) (site >> 32), (uint32_t) step, (uint32_t) (step >> 32) };
+    uint32_t key[2] = { seed, stream };
+    uint32_t bits[4];
+    Philox4x32(counter, key, bits);
+
+    // Box-Muller on two pairs of uniforms in (0, 1)
+    const double to_unit = 1.0 / 4294967296.0;
+    double r0 = sqrt(-2.0 * log((bits[0] + 0.5) * to_unit));
+    double r1 = sqrt(-2.0 * log((bits[2] + 0.5) * to_unit));
+    double phi0 = 2.0 * M_PI * bits[1] * to_unit;
+    double phi1 = 2.0 * M_PI * bits[3] * to_unit;
+    return (Vector3) { (float) (r0 * cos(phi0)), (float) (r0 * sin(phi0)), (float) (r1 * cos(phi1)) };
+}
+
+#endif
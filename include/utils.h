@@ -4,6 +4,8 @@
 #include "raylib.h"
 #include "raymath.h"
 #include <vector>
+#include <cstdint>
+#include "Numa.h"
 
 
 // simulation structs
@@ -25,8 +27,48 @@ struct Params {
     float gm_ratio = 2;
     float bohr_magneton = 0.05788;
     int sponge_width = 10; // the width of the "sponge" at the ends in number of sites
+    bool open_ends = false; // free chain ends instead of the periodic wrap
+    bool pml_on = false; // graded absorbing layers designed for pml_reflection instead of the fixed sponge
+    float pml_reflection = 1e-3f; // reflected amplitude the layers are designed for
+    int pml_order = 3; // polynomial grading of the damping across the layers
     float energy_resolution = 0.003f;
     float window_param = 0.1f;
+    float max_energy = 8.0f; // highest hbar * omega of interest (meV), sets how often snapshots are recorded
+    int decimation_order = 3; // boxcar stages of the anti-alias filter before decimation
+    int welch_segments = 1; // overlapping segments averaged per pulse, 1 = one transform of the whole recording
+    float welch_overlap = 0.5f; // overlap of neighbouring segments
+    int pulse_repeats = 1; // pulses fired one after another, their spectra are averaged
+    bool zoom_on = false; // spectrum of a (k, energy) window only, written to result_zoom.csv
+    float zoom_k_min = 0.0f; // radians per site
+    float zoom_k_max = 1.0f;
+    float zoom_energy_min = 0.0f; // meV
+    float zoom_energy_max = 2.0f;
+    int zoom_rows = 400; // energies sampled in the window
+    int zoom_ar_order = 0; // 0: chirp-z transform of the window, > 0: Burg autoregressive spectrum of this order
+    bool local_frame_on = false; // record both deviations across each spin of the ground state (complex, +-k apart) instead of S_z
+    int analysis_memory_mb = 0; // most memory the full transform may use, larger ones go through a scratch file (0 = no limit)
+    bool dispersion_on = false; // smooth, log scale and find the peaks of every k, written to result_dispersion.csv
+    float dispersion_sigma_energy = 1.5f; // Gaussian smoothing along the energy (rows of the spectrum)
+    float dispersion_sigma_k = 1.0f; // and along k (columns)
+    float dispersion_floor = 1e-5f; // bottom of the log scale, relative to the largest value
+    float dispersion_threshold = 1e-3f; // peaks lower than this fraction of the largest value are dropped
+    int dispersion_peaks = 2; // highest peaks kept per k (branches)
+    int snapshot_codec = 0; // how snapshots are stored: 0 float32, 1 int16, 2 float16 (SnapshotStore.h)
+    float snapshot_tolerance = 0.0f; // largest error of an int16 value (spin units), sets its step, 0 = max|S| / 32767 of each snapshot
+    bool dipolar_on = false; // long-range dipolar coupling along the chain
+    float dipolar_D = 0.01f; // dipolar coupling between neighbouring sites (meV)
+    bool thermal_on = false; // stochastic LLG with a thermal field
+    float temperature = 1.0f; // K
+    const float k_B = 0.08617f; // meV / K
+    uint32_t rng_seed = 1;
+    uint64_t step_counter = 0; // steps taken by the integrator, keys the thermal noise
+    int multigrid_levels = 0; // chains with 1/2, 1/4, ... of the sites relaxed first, each one the start of the next
+    bool adaptive_on = false; // error-controlled steps, dt_ps is then the spacing of the output
+    float spin_tolerance = 1e-4f; // local error allowed per step in the direction of a spin (radians)
+    float dt_max_ps = 0.05f; // longest adaptive step
+    int affinity = 0; // pinning of the OpenMP threads, AffinityPolicy in Numa.h
+    bool live_export_on = false; // publish the spins to shared memory for outside tools (LiveExport.h)
+    float live_export_interval_ps = 1.0f; // simulated time between published frames
 };
 
 struct Particle {
@@ -36,13 +78,22 @@ struct Particle {
 
 // util functons
 void DrawArrow(Particle* particle, Params* params);
-void InitParticles(std::vector<Particle>& particles, Params* params);
+void InitParticles(FirstTouchVector<Particle>& particles, Params* params);
 void DrawAxes(Params* params);
 void DrawFieldVisual(Params* params);
 
 // physics
-Vector3 CalculateH_eff(int i, const std::vector<Particle>& particles, Params* params);
-void MinimizeEnergy(std::vector<Particle>& particles, Params* params);
-float getTotalEnergy(const std::vector<Particle>& particles, Params* params);
+Vector3 ExchangeField(Vector3 l2, Vector3 l1, Vector3 r1, Vector3 r2, Params* params);
+Vector3 ZeemanField(Vector3 pos, Params* params);
+float AbsorberPeakDamping(Params* params);
+float SpongeDamping(long i, long N, float peak_damping, Params* params);
+Vector3 LLGDerivative(Vector3 H, Vector3 S, float damping, Params* params);
+Vector3 ThermalField(long i, float damping, Params* params);
+Particle InitialSite(long i, long N, uint32_t seed);
+Vector3 CalculateH_eff(int i, const FirstTouchVector<Particle>& particles, Params* params);
+float HeunStep(const FirstTouchVector<Particle>& particles, float dt, FirstTouchVector<Particle>& result,
+               FirstTouchVector<Vector3>& derivatives, Params* params);
+void MinimizeEnergy(FirstTouchVector<Particle>& particles, Params* params);
+float getTotalEnergy(const FirstTouchVector<Particle>& particles, Params* params);
 
 #endif
\ No newline at end of file
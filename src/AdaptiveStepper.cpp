@@ -0,0 +1,110 @@
+#include "AdaptiveStepper.h"
+#include <math.h>
+
+// step size controller, the error of the Euler predictor grows as dt^2
+static const float SAFETY = 0.9f;
+static const float MIN_FACTOR = 0.2f;
+static const float MAX_FACTOR = 5.0f;
+static const float MIN_STEP = 1e-6f; // ps
+
+// FORGET THE CURRENT STATE, THE NEXT advance STARTS FROM THE SITES IT IS GIVEN
+void AdaptiveStepper::reset() {
+    ready = false;
+}
+
+void AdaptiveStepper::restart(const FirstTouchVector<Particle>& particles, Params* params) {
+    end = particles;
+    end_time = 0.0;
+    output_time = 0.0;
+    if (step <= 0.0f || !ready) {
+        step = params->dt_ps;
+    }
+    field_on = params->ext_field_on;
+    damping = params->damping;
+    output_dt = params->dt_ps;
+    ready = true;
+}
+
+// ONE ACCEPTED STEP FROM end, REJECTED TRIALS ARE REPEATED WITH A SHORTER STEP
+// PARAMS: (pointer to simulation params)
+void AdaptiveStepper::take_step(Params* params) {
+    while (true) {
+        float dt = fminf(step, params->dt_max_ps);
+        float error = HeunStep(end, dt, trial, trial_derivative, params);
+        float factor = (error > 0.0f) ? SAFETY * sqrtf(params->spin_tolerance / error) : MAX_FACTOR;
+        factor = fminf(fmaxf(factor, MIN_FACTOR), MAX_FACTOR);
+        step = fminf(fmaxf(dt * factor, MIN_STEP), params->dt_max_ps);
+        if (error <= params->spin_tolerance || dt <= MIN_STEP) {
+            start.swap(end);
+            end.swap(trial);
+            start_derivative.swap(trial_derivative);
+            start_time = end_time;
+            end_time += dt;
+            accepted++;
+            return;
+        }
+        rejected++;
+    }
+}
+
+// MOVE THE CHAIN ONE OUTPUT INTERVAL (dt_ps) FORWARD
+// Steps are taken until the integrator is past the output time, and the spins there are
+// interpolated from the two states around it with the quadratic
+// S(t0 + s h) = S0 + s h dS0 + s^2 (S1 - S0 - h dS0), which matches both ends and the
+// derivative at the start. Without adaptive_on (or with thermal noise, whose variance needs a
+// fixed step) this is MinimizeEnergy.
+// PARAMS: (reference to vector of the sites, replaced by the output), (pointer to simulation params)
+void AdaptiveStepper::advance(FirstTouchVector<Particle>& particles, Params* params) {
+    if (!params->adaptive_on || params->thermal_on) {
+        MinimizeEnergy(particles, params);
+        ready = false;
+        return;
+    }
+    if (!ready || field_on != params->ext_field_on || damping != params->damping || output_dt != params->dt_ps
+        || end.size() != particles.size()) {
+        restart(particles, params);
+    }
+
+    output_time += params->dt_ps;
+    while (end_time < output_time) {
+        take_step(params);
+    }
+
+    double h = end_time - start_time;
+    float s = (float) ((output_time - start_time) / h);
+    float hs = (float) h * s;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < (int) particles.size(); i++) {
+        Vector3 S0 = start[i].spin;
+        Vector3 slope = Vector3Scale(start_derivative[i], (float) h);
+        Vector3 curvature = Vector3Subtract(Vector3Subtract(end[i].spin, S0), slope);
+        Vector3 S = Vector3Add(S0, Vector3Scale(start_derivative[i], hs));
+        particles[i].spin = Vector3Normalize(Vector3Add(S, Vector3Scale(curvature, s * s)));
+    }
+}
+
+// ONE ADAPTIVE STEP WITHOUT AN OUTPUT GRID, FOR RELAXATION
+// PARAMS: (reference to vector of the sites), (pointer to simulation params)
+// RETURNS: the length of the step (ps)
+float AdaptiveStepper::relax(FirstTouchVector<Particle>& particles, Params* params) {
+    if (!params->adaptive_on || params->thermal_on) {
+        MinimizeEnergy(particles, params);
+        return params->dt_ps;
+    }
+    restart(particles, params);
+    take_step(params);
+    particles = end;
+    return (float) (end_time - start_time);
+}
+
+float AdaptiveStepper::current_step() const {
+    return step;
+}
+
+long AdaptiveStepper::steps() const {
+    return accepted;
+}
+
+long AdaptiveStepper::rejections() const {
+    return rejected;
+}
@@ -1,94 +1,1232 @@
 #include "utils.h"
 #include "DataLogger.h"
+#include "SpectralZoom.h"
 #include <fftw3.h>
 #include <cstdlib>
 #include <vector>
 #include <string>
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <map>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-DataLogger::DataLogger(int size_hint, std::vector<Particle>& initial_state) {
-    _data.reserve(size_hint);
+// Tukey window with taper fraction alpha, alpha = 1 is the Hann window
+static float TukeyWindow(int t, int T, float alpha) {
+    float window = 1.0f;
+    if (t < alpha * T / 2.0f) {
+        window = 0.5f * (1.0f + cosf(M_PI * (2.0f * t / (alpha * T) - 1.0f)));
+    }
+    else if (t > T * (1.0f - alpha / 2.0f)) {
+        float dist = T - 1 - t;
+        window = 0.5f * (1.0f + cosf(M_PI * (2.0f * dist / (alpha * T) - 1.0f)));
+    }
+    return window;
+}
+
+// Whole reads and writes at an offset, repeated while the system transfers less
+static bool ReadAt(int fd, void* buffer, size_t bytes, off_t offset) {
+    char* position = (char*) buffer;
+    while (bytes > 0) {
+        ssize_t done = pread(fd, position, bytes, offset);
+        if (done <= 0) {
+            return false;
+        }
+        position += done;
+        bytes -= done;
+        offset += done;
+    }
+    return true;
+}
+
+static bool WriteAt(int fd, const void* buffer, size_t bytes, off_t offset) {
+    const char* position = (const char*) buffer;
+    while (bytes > 0) {
+        ssize_t done = pwrite(fd, position, bytes, offset);
+        if (done <= 0) {
+            return false;
+        }
+        position += done;
+        bytes -= done;
+        offset += done;
+    }
+    return true;
+}
+
+// Header of a compressed slice in a recording file, followed by T + 1 offsets (uint64) of the
+// snapshots in the payload and the payload, the coded snapshots of SnapshotStore
+struct SliceHeader {
+    char magic[4]; // "SPSZ"
+    int32_t codec;
+    int32_t channels;
+    int32_t n; // sites of the slice
+    int64_t offset; // global index of its first site
+    int64_t global_N;
+    int64_t T;
+    uint64_t payload; // bytes
+};
+
+DataLogger::DataLogger(size_t size_hint, FirstTouchVector<Particle>& initial_state) {
+    this->size_hint = size_hint;
 	start = initial_state;
 }
 
-void DataLogger::listen(std::vector<float>& data, Params* params) {
-    for (int i = 0; i < params->n_of_particles; i++) {
-        _data.push_back(data[i] - start[i].spin.z);
+DataLogger::~DataLogger() {
+    if (segment_plan) fftwf_destroy_plan(segment_plan);
+    fftwf_free(segment_in);
+    fftwf_free(segment_out);
+}
+
+// INTEGRATOR STEPS BETWEEN SNAPSHOTS FOR THE HIGHEST ENERGY OF INTEREST
+// Sampling at 1.5 times the Nyquist rate of params->max_energy leaves room for the
+// roll-off of the anti-alias filter.
+// PARAMS: (pointer to simulation params)
+// RETURNS: the stride in integrator steps
+int DataLogger::recording_stride(Params* params) {
+    float max_interval = M_PI * params->hbar / (1.5f * params->max_energy);
+    int steps = (int) (max_interval / params->dt_ps);
+    return (steps < 1) ? 1 : steps;
+}
+
+// SET UP THE DECIMATION FILTER
+// The filter is params->decimation_order boxcars of length stride in cascade, the impulse
+// response of a CIC decimator, applied as an FIR so no integrator can drift in floating point.
+// Also chooses what is recorded (params->local_frame_on).
+// PARAMS: (pointer to simulation params)
+// RETURNS: the stride in integrator steps
+int DataLogger::plan_recording(Params* params) {
+    set_layout(params);
+    set_frame();
+
+    std::vector<double> taps(1, 1.0);
+    for (int m = 0; m < filter_order; m++) {
+        std::vector<double> wider(taps.size() + stride - 1, 0.0);
+        for (size_t t = 0; t < taps.size(); t++) {
+            for (int r = 0; r < stride; r++) {
+                wider[t + r] += taps[t] / stride;
+            }
+        }
+        taps.swap(wider);
+    }
+    filter_taps.assign(taps.begin(), taps.end());
+    filter_slots = (int) ((filter_taps.size() + stride - 1) / stride);
+    filter_acc.assign((size_t) filter_slots * channels * params->n_of_particles, 0.0f);
+    filter_step = 0;
+    printf("Recording every %d steps through a %zu tap anti-alias filter\n", stride, filter_taps.size());
+    return stride;
+}
+
+// COMPENSATION OF THE FILTER ROLL-OFF FOR ONE FREQUENCY ROW OF THE SPECTRUM
+// The cascade has the response (sin(w stride dt / 2) / (stride sin(w dt / 2)))^order.
+// PARAMS: (row of the spectrum), (number of rows)
+// RETURNS: the factor that undoes the roll-off, 1 without decimation
+float DataLogger::droop(int t, int T) {
+    int folded = (t <= T / 2) ? t : T - t;
+    if (stride == 1 || folded == 0) {
+        return 1.0f;
+    }
+    return droop_angle(2.0 * M_PI * folded / T);
+}
+
+// THE SAME AT ANY FREQUENCY
+// PARAMS: (radians per snapshot)
+float DataLogger::droop_angle(double theta) {
+    double x = fabs(remainder(theta, 2.0 * M_PI)) / 2.0;
+    if (stride == 1 || x == 0.0) {
+        return 1.0f;
     }
+    double response = sin(x) / (stride * sin(x / stride));
+    return (float) pow(fabs(response), -filter_order);
+}
 
+// FEED ONE INTEGRATOR STEP TO THE DECIMATION FILTER
+// Snapshot j is the filtered S_z (or the two local-frame components) over the steps
+// [j * stride, j * stride + taps), it is handed on as soon as its last step has been added.
+// PARAMS: (the sites, params->n_of_particles of them), (pointer to simulation params)
+void DataLogger::record(const Particle* sites, Params* params) {
+    int N = params->n_of_particles;
+    int width = channels * N;
+    long length = (long) filter_taps.size();
+    long n = filter_step;
+    long first = (n - length + 1 <= 0) ? 0 : (n - length + stride) / stride;
+    const float* f = frame.data();
+    for (long j = first; j <= n / stride; j++) {
+        float tap = filter_taps[n - j * stride];
+        float* acc = &filter_acc[(size_t) (j % filter_slots) * width];
+        if (channels == 1) {
+			#pragma omp parallel for simd schedule(static)
+            for (int i = 0; i < N; i++) {
+                acc[i] += tap * sites[i].spin.z;
+            }
+        }
+        else {
+            // projections on e1 and e2, the frame is read in planes so the loop vectorizes
+			#pragma omp parallel for simd schedule(static)
+            for (int i = 0; i < N; i++) {
+                float x = sites[i].spin.x, y = sites[i].spin.y, z = sites[i].spin.z;
+                acc[i] += tap * (x * f[i] + y * f[N + i] + z * f[2 * N + i]);
+                acc[N + i] += tap * (x * f[3 * N + i] + y * f[4 * N + i] + z * f[5 * N + i]);
+            }
+        }
+        if (n - j * stride == length - 1) {
+            append(acc, params);
+            for (int i = 0; i < width; i++) {
+                acc[i] = 0.0f;
+            }
+        }
+    }
+    filter_step++;
+}
+
+// WHAT A SNAPSHOT HOLDS AND HOW OFTEN IT WAS TAKEN
+// PARAMS: (pointer to simulation params)
+void DataLogger::set_layout(Params* params) {
+    channels = params->local_frame_on ? 2 : 1;
+    n_sites = params->n_of_particles;
+    stride = recording_stride(params);
+    filter_order = (params->decimation_order < 1) ? 1 : params->decimation_order;
+}
+
+// LOCAL FRAME OF EVERY SITE OF start
+// e1 = z x S / |z x S| (x x S for a spin along z) and e2 = S x e1, which is z for a spin in the
+// plane of a spiral. The deviations along e1 and e2 are the real and imaginary parts of one
+// complex value, so a spin precessing about its direction in start is a single rotating phasor
+// and waves running towards +k and -k land on different sides of the spectrum.
+void DataLogger::set_frame() {
+    int N = (int) start.size();
+    baseline.resize((size_t) channels * N);
+    if (channels == 1) {
+        for (int i = 0; i < N; i++) {
+            baseline[i] = start[i].spin.z;
+        }
+        return;
+    }
+    frame.resize((size_t) 6 * N);
+	#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++) {
+        Vector3 spin = Vector3Normalize(start[i].spin);
+        Vector3 e1 = Vector3CrossProduct((Vector3) { 0.0f, 0.0f, 1.0f }, spin);
+        if (Vector3Length(e1) < 0.1f) {
+            e1 = Vector3CrossProduct((Vector3) { 1.0f, 0.0f, 0.0f }, spin);
+        }
+        e1 = Vector3Normalize(e1);
+        Vector3 e2 = Vector3CrossProduct(spin, e1);
+        float axes[6] = { e1.x, e1.y, e1.z, e2.x, e2.y, e2.z };
+        for (int c = 0; c < 6; c++) {
+            frame[(size_t) c * N + i] = axes[c];
+        }
+        baseline[i] = Vector3DotProduct(start[i].spin, e1);
+        baseline[N + i] = Vector3DotProduct(start[i].spin, e2);
+    }
+}
+
+// k OF THE SPECTRUM: 0 ... N / 2 for the real S_z, all N of them for the complex local frame
+int DataLogger::bins() const {
+    return (channels == 2) ? n_sites : n_sites / 2 + 1;
+}
+
+// READ SNAPSHOTS AS THE INPUT OF A TRANSFORM
+// S_z rows are used as they are, local-frame rows are interleaved into N complex values.
+// PARAMS: (first snapshot), (number of snapshots), (output: count rows of channels * N floats)
+void DataLogger::load(long first, long count, float* rows) {
+    if (channels == 1) {
+        _data.read_block(first, count, rows);
+        return;
+    }
+    int N = n_sites;
+    planar.resize((size_t) count * 2 * N);
+    _data.read_block(first, count, planar.data());
+	#pragma omp parallel for
+    for (long t = 0; t < count; t++) {
+        const float* source = &planar[(size_t) t * 2 * N];
+        float* target = rows + (size_t) t * 2 * N;
+        for (int i = 0; i < N; i++) {
+            target[2 * i] = source[i];
+            target[2 * i + 1] = source[N + i];
+        }
+    }
+}
+
+void DataLogger::append(const float* values, Params* params) {
+    int width = channels * params->n_of_particles;
+    if (!_data.configured()) {
+        _data.configure(params->snapshot_codec, width, params->snapshot_tolerance);
+        _data.reserve(size_hint * channels);
+    }
+    row.resize(width);
+    for (int i = 0; i < width; i++) {
+        row[i] = values[i] - baseline[i];
+    }
+    _data.push(row.data());
+
+    // Transform every segment as soon as it is complete
+    if (segment_length > 0) {
+        long recorded = consumed + _data.size();
+        while (recorded >= next_segment + segment_length) {
+            process_segment(params);
+        }
+    }
+}
+
+// AVERAGE THE SPECTRUM OVER SEGMENTS INSTEAD OF ONE TRANSFORM OF THE WHOLE RECORDING
+// The recording is cut into Hann-windowed segments of the given length which overlap by
+// params->welch_overlap (Welch's method), and the power spectra of the segments are
+// averaged. The spectrum file is rewritten after every segment.
+// PARAMS: (snapshots per segment, sets the frequency resolution), (pointer to simulation params)
+// RETURNS: false if the transform couldn't be planned
+bool DataLogger::plan_segments(int length, Params* params) {
+    int N = params->n_of_particles;
+    int n_of_bins = bins();
+    segment_in = fftwf_alloc_real((size_t) length * channels * N);
+    segment_out = fftwf_alloc_complex((size_t) length * n_of_bins);
+    if (!segment_in || !segment_out) {
+        perror("Failed to allocate space for the segment transform\n");
+        return false;
+    }
+    if (channels == 2) {
+        segment_plan = fftwf_plan_dft_2d(length, N, (fftwf_complex*) segment_in, segment_out, FFTW_FORWARD, FFTW_ESTIMATE);
+    }
+    else {
+        segment_plan = fftwf_plan_dft_r2c_2d(length, N, segment_in, segment_out, FFTW_ESTIMATE);
+    }
+    if (segment_plan == NULL) {
+        perror("Failed to create plan for the segments\n");
+        return false;
+    }
+    segment_length = length;
+    segment_hop = (int) (length * (1.0f - params->welch_overlap));
+    if (segment_hop < 1) {
+        segment_hop = 1;
+    }
+    power_sum.assign((size_t) length * n_of_bins, 0.0f);
+    return true;
+}
+
+// START A NEW BLOCK OF THE RECORDING AFTER ANOTHER PULSE
+// Segments never straddle two blocks, and deviations are measured from the new state.
+// PARAMS: (state right before the pulse)
+void DataLogger::next_block(FirstTouchVector<Particle>& state) {
+    start = state;
+    set_frame();
+    consumed += _data.size();
+    _data.clear();
+    next_segment = consumed;
+    filter_step = 0;
+    for (float& acc : filter_acc) {
+        acc = 0.0f;
+    }
+}
+
+// TRANSFORM THE NEXT SEGMENT AND ADD ITS POWER TO THE SUM
+// PARAMS: (pointer to simulation params)
+void DataLogger::process_segment(Params* params) {
+    int width = channels * params->n_of_particles;
+    int n_of_bins = bins();
+    int L = segment_length;
+    load(next_segment - consumed, L, segment_in);
+
+	#pragma omp parallel for
+    for (int t = 0; t < L; t++) {
+        float window = TukeyWindow(t, L, 1.0f);
+        for (int p = 0; p < width; p++) {
+            segment_in[(size_t) t * width + p] *= window;
+        }
+    }
+    fftwf_execute(segment_plan);
+
+	#pragma omp parallel for
+    for (long idx = 0; idx < (long) L * n_of_bins; idx++) {
+        power_sum[idx] += segment_out[idx][0] * segment_out[idx][0] + segment_out[idx][1] * segment_out[idx][1];
+    }
+    segments_done++;
+    next_segment += segment_hop;
+
+    // Samples before the next segment are no longer needed
+    long drop = next_segment - consumed;
+    if (drop > 0) {
+        _data.drop_front(drop);
+        consumed = next_segment;
+    }
+
+    printf("Averaged %d segments\n", segments_done);
+    write_spectrum(output("result_big3.csv").c_str(), params);
+}
+
+// WRITE THE AVERAGED SPECTRUM IN THE SAME FORMAT AS analyze
+// PARAMS: (path of the csv), (pointer to simulation params)
+void DataLogger::write_spectrum(const char* path, Params* params) {
+    FILE* filePtr = fopen(path, "w");
+    if (filePtr == nullptr) {
+        perror("Couldn't create result.csv");
+        return;
+    }
+    std::vector<float> map;
+    segment_spectrum(map, 0, params);
+    int n_of_bins = bins();
+    for (int t = 0; t < segment_length; t++) {
+		for (int k = 0; k < n_of_bins; k++) {
+			fprintf(filePtr, "%f%s", map[(size_t) t * n_of_bins + k], (k == n_of_bins - 1) ? "" : ",");
+		}
+		fprintf(filePtr, "\n");
+    }
+    fclose(filePtr);
+}
+
+// MAGNITUDES OF THE SPECTRUM AVERAGED OVER THE SEGMENTS SO FAR
+// PARAMS: (output: segment_length rows of bins() + 2 * halo floats, the magnitudes after the
+//         first halo of them), (columns left free on both sides), (pointer to simulation params)
+void DataLogger::segment_spectrum(std::vector<float>& map, long halo, Params* params) {
+    int N = params->n_of_particles;
+    int n_of_bins = bins();
+    long row_floats = n_of_bins + 2 * halo;
+	float normalize = 1.0f / ((float) segment_length * N);
+    float amplitude = (channels == 2) ? 1.0f : 2.0f; // a real signal has half its amplitude at -omega
+    map.resize((size_t) segment_length * row_floats);
+	#pragma omp parallel for
+    for (int t = 0; t < segment_length; t++) {
+		for (int k = 0; k < n_of_bins; k++) {
+			float power = power_sum[(size_t) t * n_of_bins + k] / segments_done;
+			map[(size_t) t * row_floats + halo + k] = sqrtf(power) * amplitude * normalize * droop(t, segment_length);
+		}
+    }
+}
+
+// Directory for the result files
+void DataLogger::set_output_dir(const std::string& dir) {
+    output_dir = dir;
+}
+
+std::string DataLogger::output(const char* name) {
+    return output_dir.empty() ? std::string(name) : output_dir + "/" + name;
+}
+
+// Linear spin-wave modes to write next to the spectrum
+void DataLogger::overlay(const std::vector<SpinWaveMode>& modes) {
+    overlay_modes = modes;
+}
+
+// COLUMN OF THE SPECTRUM THAT STANDS IN FOR ONE PAST ITS EDGES
+// Complex k wrap around the chain, real ones are mirrored at 0 and N / 2.
+// PARAMS: (column, may lie outside 0 ... bins() - 1)
+// RETURNS: the column inside
+long DataLogger::halo_column(long column) const {
+    long n_of_bins = bins();
+    if (channels == 2) {
+        return ((column % n_of_bins) + n_of_bins) % n_of_bins;
+    }
+    if (n_of_bins < 2) {
+        return 0;
+    }
+    while (column < 0 || column >= n_of_bins) {
+        column = (column < 0) ? -column : 2 * (n_of_bins - 1) - column;
+    }
+    return column;
+}
+
+// SMOOTH, LOG SCALE AND SEARCH A PART OF THE SPECTRUM
+// The peaks are added to peaks. Parts of one spectrum share the largest value, so the floor
+// and the threshold are the same for all of them. The magnitudes are smoothed in place.
+// PARAMS: (magnitudes with halo columns on both sides, overwritten), (rows), (columns
+//         without the halo), (floats per row), (true for the periodic energies of an FFT),
+//         (largest magnitude of the whole spectrum), (first and last row searched),
+//         (k bin of the first column), (pointer to simulation params)
+void DataLogger::find_peaks(float* padded, long rows, long cols, long row_floats, bool wrap_rows, float largest,
+                            long first_row, long last_row, long first_column, Params* params) {
+    if (largest <= 0.0f) {
+        return;
+    }
+    float floor = largest * ((params->dispersion_floor > 0.0f) ? params->dispersion_floor : 1e-12f);
+    GaussianSmooth(padded, rows, row_floats, cols, wrap_rows, GaussianTaps(params->dispersion_sigma_energy),
+                   GaussianTaps(params->dispersion_sigma_k));
+    LogScale(padded, (size_t) rows * cols, floor);
+    size_t before = peaks.size();
+    FindPeaks(padded, rows, cols, first_row, last_row, log10f(largest * params->dispersion_threshold),
+              params->dispersion_peaks, peaks);
+    for (size_t p = before; p < peaks.size(); p++) {
+        peaks[p].column += first_column;
+    }
+}
+
+// FOLD THE NEGATIVE ENERGIES OF A REAL RECORDING ONTO THE POSITIVE ONES
+// The k >= 0 of a real recording hold the waves running both ways, one at +omega and the other at
+// -omega. Their powers are added, so every branch is searched once at |energy|. Complex
+// recordings keep their signed energies.
+// PARAMS: (map of T rows, folded in place), (rows), (floats per row)
+// RETURNS: the rows left, T / 2 + 1 for a real recording
+long DataLogger::fold_rows(float* map, long T, long row_floats) const {
+    if (channels == 2) {
+        return T;
+    }
+	#pragma omp parallel for
+    for (long t = 1; t < (T + 1) / 2; t++) {
+        float* positive = map + (size_t) t * row_floats;
+        const float* negative = map + (size_t) (T - t) * row_floats;
+        for (long c = 0; c < row_floats; c++) {
+            positive[c] = sqrtf(positive[c] * positive[c] + negative[c] * negative[c]);
+        }
+    }
+    return T / 2 + 1;
+}
+
+// DISPERSION TABLE OF A WHOLE SPECTRUM IN MEMORY
+// The caller leaves the halo columns free, so the map is padded, folded and smoothed in place.
+// PARAMS: (magnitudes, T rows of bins() + 2 * halo floats with the halo columns on both sides,
+//         overwritten), (rows), (pointer to simulation params)
+void DataLogger::dispersion_of_spectrum(float* padded, long T, Params* params) {
+    long n_of_bins = bins();
+    long halo = (long) GaussianTaps(params->dispersion_sigma_k).size() / 2;
+    long row_floats = n_of_bins + 2 * halo;
+    float largest = 0.0f;
+	#pragma omp parallel for reduction(max:largest)
+    for (long t = 0; t < T; t++) {
+        float* row = padded + (size_t) t * row_floats + halo;
+        for (long c = 1; c <= halo; c++) {
+            row[-c] = row[halo_column(-c)];
+            row[n_of_bins - 1 + c] = row[halo_column(n_of_bins - 1 + c)];
+        }
+        for (long c = 0; t >= 1 && c < n_of_bins; c++) {
+            largest = fmaxf(largest, row[c]);
+        }
+    }
+    long rows = fold_rows(padded, T, row_floats);
+    peaks.clear();
+    find_peaks(padded, rows, n_of_bins, row_floats, channels == 2, largest, 1, rows - 2, 0, params);
+    write_dispersion(T, 2.0 * M_PI * params->hbar / (T * stride * params->dt_ps), 0.0, 0, params);
+}
+
+// WRITE THE PEAKS AS k, ENERGY, WIDTH AND AMPLITUDE
+// A few lines per k instead of the whole spectrum, in the units of the spectrum files.
+// PARAMS: (rows of the spectrum if its energies wrap around (FFT), 0 for a window), (meV per row),
+//         (energy of row 0), (k bin of column 0), (pointer to simulation params)
+void DataLogger::write_dispersion(long wrap_rows, double energy_step, double energy_first, long k_first, Params* params) {
+    FILE* filePtr = fopen(output("result_dispersion.csv").c_str(), "w");
+    if (filePtr == nullptr) {
+        perror("Couldn't create result_dispersion.csv");
+        return;
+    }
+    int N = params->n_of_particles;
+    fprintf(filePtr, "k,energy_meV,width_meV,amplitude\n");
+    for (const DispersionPeak& peak : peaks) {
+        long bin = k_first + peak.column;
+        double row = peak.row;
+        // the upper halves of the FFT rows and of the complex k are negative
+        if (wrap_rows > 0 && row > wrap_rows / 2) row -= wrap_rows;
+        if (wrap_rows > 0 && channels == 2 && bin > N / 2) bin -= N;
+        fprintf(filePtr, "%f,%f,%f,%g\n", 2.0 * M_PI * bin / N, energy_first + row * energy_step,
+                peak.width * energy_step, peak.amplitude);
+    }
+    fclose(filePtr);
+    printf("Found %zu peaks, wrote result_dispersion.csv\n", peaks.size());
 }
 
 void DataLogger::analyze(Params* params) {
     int N = params->n_of_particles;
-    int T = _data.size() / N;
+    int T = (int) _data.size();
+    _data.report();
+
+    if (params->zoom_on && segment_length == 0) {
+        analyze_zoom(params);
+        return;
+    }
+
+    // The segments were transformed while recording
+    if (segment_length > 0) {
+        if (params->zoom_on) {
+            printf("The zoom needs the whole recording, writing the averaged spectrum instead\n");
+        }
+        if (segments_done == 0) {
+            printf("The recording was shorter than one segment\n");
+            return;
+        }
+        printf("Saving the spectrum averaged over %d segments...\n", segments_done);
+        write_spectrum(output("result_big3.csv").c_str(), params);
+        if (params->dispersion_on) {
+            std::vector<float> map;
+            segment_spectrum(map, (long) GaussianTaps(params->dispersion_sigma_k).size() / 2, params);
+            dispersion_of_spectrum(map.data(), segment_length, params);
+        }
+        if (!overlay_modes.empty()) {
+            WriteSpinWaves(output("result_lswt.csv").c_str(), overlay_modes, params);
+        }
+        return;
+    }
+
+	int n_of_bins = bins();
+    int width = channels * N;
+    size_t complex_out_size = (size_t) T * n_of_bins;
+    int B = (T < 256) ? T : 256; // snapshots decoded at a time
+    size_t needed = complex_out_size * sizeof(fftwf_complex) + (size_t) B * (width * sizeof(float) + n_of_bins * sizeof(fftwf_complex));
+    if (params->analysis_memory_mb > 0 && needed > (size_t) params->analysis_memory_mb << 20) {
+        transform_out_of_core([this](long first, long count, float* rows) { load(first, count, rows); }, T, params);
+        if (!overlay_modes.empty()) {
+            WriteSpinWaves(output("result_lswt.csv").c_str(), overlay_modes, params);
+        }
+        return;
+    }
 
 	printf("Planning the discrete fourier transform...\n");
-    // Plan the DFT
-	int n_of_bins = N / 2 + 1;
-    int complex_out_size = T * n_of_bins;
+    // Plan the DFT: along the chain for a block of snapshots as they are decoded, then along time
+    // in place, so the recording is never held decoded as a whole
     fftwf_complex* out = fftwf_alloc_complex(complex_out_size);
-	float* in = fftwf_alloc_real(N * T);
-	if (!out || !in) {
+	float* rows = fftwf_alloc_real((size_t) B * width);
+	fftwf_complex* spectrum = fftwf_alloc_complex((size_t) B * n_of_bins);
+	if (!out || !rows || !spectrum) {
 		perror("Failed to allocate space for the discrete fourier transform\n");
+		fftwf_free(out);
+		fftwf_free(rows);
+		fftwf_free(spectrum);
 		return;
 	}
-    fftwf_plan plan = fftwf_plan_dft_r2c_2d(T, N, in, out, FFTW_ESTIMATE);
+    fftwf_plan plan;
+    if (channels == 2) {
+        plan = fftwf_plan_many_dft(1, &N, B, (fftwf_complex*) rows, NULL, 1, N, spectrum, NULL, 1, N, FFTW_FORWARD, FFTW_ESTIMATE);
+    }
+    else {
+        plan = fftwf_plan_many_dft_r2c(1, &N, B, rows, NULL, 1, N, spectrum, NULL, 1, n_of_bins, FFTW_ESTIMATE);
+    }
+    fftwf_plan columns = fftwf_plan_many_dft(1, &T, n_of_bins, out, NULL, n_of_bins, 1, out, NULL, n_of_bins, 1, FFTW_FORWARD, FFTW_ESTIMATE);
 	printf("T = %d\n", T);
-	if (plan == NULL) {
+	if (plan == NULL || columns == NULL) {
 		perror("Failed to create plan\n");
-		free(out);
-		free(in);
+		if (plan) fftwf_destroy_plan(plan);
+		if (columns) fftwf_destroy_plan(columns);
+		fftwf_free(out);
+		fftwf_free(rows);
+		fftwf_free(spectrum);
 		return;
 	}
 
-    // Initialize the input
-	printf("Plam finished! Initializing the input... \n");
-
-    for (int i = 0; i < (T * N); i++) {
-        in[i] = _data[i];
-    }
-
-	// Tukey window
-	#pragma omp parallel for
-    for (int t = 0; t < T; t++) {
-        float window = 1.0f;
-        if (t < params->window_param * T / 2.0f) {
-            window = 0.5f * (1.0f + cosf(M_PI * (2.0f * t / (params->window_param * T) - 1.0f)));
-        }
-        else if (t > T * (1.0f - params->window_param / 2.0f)) {
-            float dist = T - 1 - t;
-            window = 0.5f * (1.0f + cosf(M_PI * (2.0f * dist / (params->window_param * T) - 1.0f)));
-        }
-
-        for (int p = 0; p < N; p++) {
-            in[t * N + p] *= window;
+	printf("Plam finished! Transforming the snapshots along the chain... \n");
+    // decoded a block of snapshots at a time, Tukey windowed
+    for (int t0 = 0; t0 < T; t0 += B) {
+        int count = (T - t0 < B) ? T - t0 : B;
+        load(t0, count, rows);
+		#pragma omp parallel for
+        for (int t = 0; t < B; t++) {
+            float window = (t < count) ? TukeyWindow(t0 + t, T, params->window_param) : 0.0f;
+            for (int p = 0; p < width; p++) {
+                rows[(size_t) t * width + p] = (t < count) ? rows[(size_t) t * width + p] * window : 0.0f;
+            }
         }
+        fftwf_execute(plan);
+        memcpy(out + (size_t) t0 * n_of_bins, spectrum, (size_t) count * n_of_bins * sizeof(fftwf_complex));
     }
+    fftwf_destroy_plan(plan);
+    fftwf_free(rows);
+    fftwf_free(spectrum);
 
-	printf("Executing fourier transorm...\n");
-	// execute DFT
-    fftwf_execute(plan);
+	printf("Executing fourier transorm along time...\n");
+    fftwf_execute(columns);
+    fftwf_destroy_plan(columns);
 
 	printf("Saving results...\n");
     // Print results to a csv file
-    FILE* filePtr = fopen("result_big3.csv", "w");
+    FILE* filePtr = fopen(output("result_big3.csv").c_str(), "w");
     if (filePtr == nullptr) {
         perror("Couldn't create result.csv");
     }
-	float normalize = 1.0f / float(T*N);
+	float normalize = 1.0f / ((float) T * N);
+    float amplitude = (channels == 2) ? 1.0f : 2.0f;
+    // the magnitudes for the dispersion with room for its halo columns, so it works on them in place
+    long halo = (long) GaussianTaps(params->dispersion_sigma_k).size() / 2;
+    long row_floats = n_of_bins + 2 * halo;
+    std::vector<float> map(params->dispersion_on ? (size_t) T * row_floats : 0);
     for (int t = 0; t < T; t++) {
-		for (int k = 0; k < (N / 2 + 1); k++) {
-			int idx = t * n_of_bins + k;
- 	    	float magnitude = sqrt( (out[idx][0] * out[idx][0]) + (out[idx][1] * out[idx][1]) ) * 2 * normalize;
+		for (int k = 0; k < n_of_bins; k++) {
+			size_t idx = (size_t) t * n_of_bins + k;
+ 	    	float magnitude = sqrt( (out[idx][0] * out[idx][0]) + (out[idx][1] * out[idx][1]) ) * amplitude * normalize * droop(t, T);
 			fprintf(filePtr, "%f%s", magnitude, (k == n_of_bins - 1) ? "" : ",");
+			if (params->dispersion_on) map[(size_t) t * row_floats + halo + k] = magnitude;
 		}
 		fprintf(filePtr, "\n");
     }
-
-    // Cleanup
     fclose(filePtr);
-    fftwf_destroy_plan(plan);
+    // the complex spectrum is not needed for the table
     fftwf_free(out);
-	fftwf_free(in);
-}
\ No newline at end of file
+
+    if (params->dispersion_on) {
+        dispersion_of_spectrum(map.data(), T, params);
+    }
+
+    // Linear spin waves on the same grid
+    if (!overlay_modes.empty()) {
+        WriteSpinWaves(output("result_lswt.csv").c_str(), overlay_modes, params);
+    }
+}
+
+// SPECTRUM OF A RECORDING THAT DOESN'T FIT IN MEMORY
+// The 2D transform is split into passes over a scratch file, none of which holds more than
+// params->analysis_memory_mb:
+// 1. blocks of snapshots are windowed and transformed along the chain, and each block is cut
+//    into strips of k, every piece written to where its strip lives in the file. Strip s holds
+//    [t][k of s] for all t, so this is the transpose, done a block at a time.
+// 2. every strip is read back whole, transformed along time, and its magnitudes written over it.
+// 3. the csv is put together a block of rows at a time from the pieces of all strips.
+// 4. with params->dispersion_on, the strips are read again with the k next to them and their peaks
+//    are found (Dispersion.h).
+// Every read and write is one contiguous run of a block of one strip, so the passes go at the
+// speed of the disk rather than of its seeks.
+// PARAMS: (reads count snapshots from first as rows of channels * N floats, complex interleaved),
+//         (number of snapshots), (pointer to simulation params)
+// RETURNS: false if the scratch file couldn't be used
+bool DataLogger::transform_out_of_core(const RowReader& read, long T, Params* params) {
+    int N = params->n_of_particles;
+    int width = channels * N;
+    long n_of_bins = bins();
+    size_t budget = (size_t) (params->analysis_memory_mb > 0 ? params->analysis_memory_mb : 1) << 20;
+    // snapshots per block: the rows, their transform and the piece of a strip
+    long B = (long) (budget / ((size_t) width * sizeof(float) + 2 * n_of_bins * sizeof(fftwf_complex)));
+    B = (B < 1) ? 1 : (B > T) ? T : B;
+    // k per strip: the strip and its magnitudes
+    long K = (long) (budget / ((size_t) T * (sizeof(fftwf_complex) + sizeof(float))));
+    K = (K < 1) ? 1 : (K > n_of_bins) ? n_of_bins : K;
+    long n_strips = (n_of_bins + K - 1) / K;
+    printf("Transforming %ld snapshots of %d sites out of core: blocks of %ld snapshots, %ld strips of %ld k, %.2f GB of scratch\n",
+           T, N, B, n_strips, K, (double) T * n_of_bins * sizeof(fftwf_complex) / 1e9);
+
+    std::string scratch = output("spectrum_scratch.bin");
+    int fd = open(scratch.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Couldn't create the scratch file");
+        return false;
+    }
+    unlink(scratch.c_str()); // gone when closed, however the transform ends
+
+    // Pass 1: along the chain, a block of snapshots at a time
+    bool ok = true;
+    float* rows = fftwf_alloc_real((size_t) B * width);
+    fftwf_complex* spectrum = fftwf_alloc_complex((size_t) B * n_of_bins);
+    fftwf_complex* piece = fftwf_alloc_complex((size_t) B * K);
+    fftwf_plan plan = nullptr;
+    if (rows && spectrum && piece && channels == 2) {
+        plan = fftwf_plan_many_dft(1, &N, (int) B, (fftwf_complex*) rows, NULL, 1, N, spectrum, NULL, 1, N, FFTW_FORWARD, FFTW_ESTIMATE);
+    }
+    else if (rows && spectrum && piece) {
+        plan = fftwf_plan_many_dft_r2c(1, &N, (int) B, rows, NULL, 1, N, spectrum, NULL, 1, (int) n_of_bins, FFTW_ESTIMATE);
+    }
+    if (plan == nullptr) {
+        perror("Failed to plan the transform along the chain");
+        ok = false;
+    }
+    for (long t0 = 0; ok && t0 < T; t0 += B) {
+        long count = (T - t0 < B) ? T - t0 : B;
+        read(t0, count, rows);
+		#pragma omp parallel for
+        for (long t = 0; t < B; t++) {
+            float* row = rows + (size_t) t * width;
+            float window = (t < count) ? TukeyWindow((int) (t0 + t), (int) T, params->window_param) : 0.0f;
+            for (int p = 0; p < width; p++) {
+                row[p] = (t < count) ? row[p] * window : 0.0f;
+            }
+        }
+        fftwf_execute(plan);
+        for (long s = 0; ok && s < n_strips; s++) {
+            long k0 = s * K;
+            long w = (n_of_bins - k0 < K) ? n_of_bins - k0 : K;
+			#pragma omp parallel for
+            for (long t = 0; t < count; t++) {
+                memcpy(piece + (size_t) t * w, spectrum + (size_t) t * n_of_bins + k0, w * sizeof(fftwf_complex));
+            }
+            off_t position = (off_t) (((size_t) k0 * T + (size_t) t0 * w) * sizeof(fftwf_complex));
+            ok = WriteAt(fd, piece, (size_t) count * w * sizeof(fftwf_complex), position);
+        }
+    }
+    if (plan) fftwf_destroy_plan(plan);
+    fftwf_free(rows);
+    fftwf_free(spectrum);
+    fftwf_free(piece);
+
+    // Pass 2: along time, a strip at a time
+    fftwf_complex* strip = ok ? fftwf_alloc_complex((size_t) T * K) : nullptr;
+    float* magnitude = ok ? fftwf_alloc_real((size_t) T * K) : nullptr;
+    if (ok && (!strip || !magnitude)) {
+        perror("Failed to allocate space for a strip");
+        ok = false;
+    }
+    std::vector<float> compensation(T);
+    for (long t = 0; t < T; t++) {
+        compensation[t] = droop((int) t, (int) T);
+    }
+    float normalize = ((channels == 2) ? 1.0f : 2.0f) / ((float) T * N);
+    float largest = 0.0f; // away from the zero energy, for the dispersion table
+    for (long s = 0; ok && s < n_strips; s++) {
+        long k0 = s * K;
+        long w = (n_of_bins - k0 < K) ? n_of_bins - k0 : K;
+        off_t position = (off_t) ((size_t) k0 * T * sizeof(fftwf_complex));
+        if (!ReadAt(fd, strip, (size_t) T * w * sizeof(fftwf_complex), position)) {
+            ok = false;
+            break;
+        }
+        int length = (int) T;
+        fftwf_plan columns = fftwf_plan_many_dft(1, &length, (int) w, strip, NULL, (int) w, 1, strip, NULL, (int) w, 1, FFTW_FORWARD, FFTW_ESTIMATE);
+        if (columns == nullptr) {
+            perror("Failed to plan the transform along time");
+            ok = false;
+            break;
+        }
+        fftwf_execute(columns);
+        fftwf_destroy_plan(columns);
+		#pragma omp parallel for reduction(max:largest)
+        for (long t = 0; t < T; t++) {
+            for (long j = 0; j < w; j++) {
+                const fftwf_complex& value = strip[(size_t) t * w + j];
+                magnitude[(size_t) t * w + j] = sqrtf(value[0] * value[0] + value[1] * value[1]) * normalize * compensation[t];
+                if (t >= 1) largest = fmaxf(largest, magnitude[(size_t) t * w + j]);
+            }
+        }
+        ok = WriteAt(fd, magnitude, (size_t) T * w * sizeof(float), position);
+    }
+    fftwf_free(strip);
+    fftwf_free(magnitude);
+
+    // Pass 3: rows of the csv from the magnitudes of all strips
+    FILE* filePtr = ok ? fopen(output("result_big3.csv").c_str(), "w") : nullptr;
+    if (ok && filePtr == nullptr) {
+        perror("Couldn't create result.csv");
+        ok = false;
+    }
+    long R = (long) (budget / (2 * n_of_bins * sizeof(float)));
+    R = (R < 1) ? 1 : (R > T) ? T : R;
+    std::vector<float> block, part;
+    if (ok) {
+        block.resize((size_t) R * n_of_bins);
+        part.resize((size_t) R * K);
+    }
+    for (long t0 = 0; ok && t0 < T; t0 += R) {
+        long count = (T - t0 < R) ? T - t0 : R;
+        for (long s = 0; ok && s < n_strips; s++) {
+            long k0 = s * K;
+            long w = (n_of_bins - k0 < K) ? n_of_bins - k0 : K;
+            off_t position = (off_t) (((size_t) k0 * T * sizeof(fftwf_complex)) + (size_t) t0 * w * sizeof(float));
+            ok = ReadAt(fd, part.data(), (size_t) count * w * sizeof(float), position);
+            for (long t = 0; ok && t < count; t++) {
+                memcpy(&block[(size_t) t * n_of_bins + k0], &part[(size_t) t * w], w * sizeof(float));
+            }
+        }
+        for (long t = 0; ok && t < count; t++) {
+            for (long k = 0; k < n_of_bins; k++) {
+                fprintf(filePtr, "%f%s", block[(size_t) t * n_of_bins + k], (k == n_of_bins - 1) ? "" : ",");
+            }
+            fprintf(filePtr, "\n");
+        }
+    }
+    if (filePtr) fclose(filePtr);
+
+    // Pass 4: the dispersion table, a strip at a time with the neighbouring k the smoothing reaches
+    if (ok && params->dispersion_on) {
+        long halo = (long) GaussianTaps(params->dispersion_sigma_k).size() / 2;
+        std::vector<float> padded;
+        peaks.clear();
+        for (long s = 0; ok && s < n_strips; s++) {
+            long k0 = s * K;
+            long w = (n_of_bins - k0 < K) ? n_of_bins - k0 : K;
+            long row_floats = w + 2 * halo;
+            padded.resize((size_t) T * row_floats);
+            // (column in its strip, column of padded), by the strip that holds them
+            std::map<long, std::vector<std::pair<long, long>>> wanted;
+            for (long c = -halo; c < w + halo; c++) {
+                long source = halo_column(k0 + c);
+                wanted[source / K].push_back(std::make_pair(source % K, c + halo));
+            }
+            for (const auto& from : wanted) {
+                long first = from.first * K;
+                long w_from = (n_of_bins - first < K) ? n_of_bins - first : K;
+                for (long t0 = 0; ok && t0 < T; t0 += R) {
+                    long count = (T - t0 < R) ? T - t0 : R;
+                    off_t position = (off_t) (((size_t) first * T * sizeof(fftwf_complex)) + (size_t) t0 * w_from * sizeof(float));
+                    ok = ReadAt(fd, part.data(), (size_t) count * w_from * sizeof(float), position);
+                    for (long t = 0; ok && t < count; t++) {
+                        for (const std::pair<long, long>& column : from.second) {
+                            padded[(size_t) (t0 + t) * row_floats + column.second] = part[(size_t) t * w_from + column.first];
+                        }
+                    }
+                }
+            }
+            if (ok) {
+                long rows = fold_rows(padded.data(), T, row_floats);
+                find_peaks(padded.data(), rows, w, row_floats, channels == 2, largest, 1, rows - 2, k0, params);
+            }
+        }
+        if (ok) {
+            write_dispersion(T, 2.0 * M_PI * params->hbar / (T * stride * params->dt_ps), 0.0, 0, params);
+        }
+    }
+    close(fd);
+    if (!ok) {
+        perror("The out of core transform failed");
+    }
+    return ok;
+}
+
+// SPECTRUM OF A WINDOW OF (k, ENERGY) ONLY
+// Every snapshot is transformed along the chain and only the k in [zoom_k_min, zoom_k_max] are
+// kept. The time series of each of those k then goes through a chirp-z transform that samples
+// zoom_rows energies in [zoom_energy_min, zoom_energy_max], however narrow the band, instead of
+// the T rows of the full transform. With zoom_ar_order > 0 the series are fitted with an
+// autoregressive model (Burg) and its spectrum is sampled instead. It resolves branches closer
+// than 2 pi hbar / recording time, but its peak heights are not amplitudes.
+// The file has the energy in the first column and one column per k, with the k in the header.
+// Local-frame recordings can have negative k and energies in the window.
+// PARAMS: (pointer to simulation params)
+void DataLogger::analyze_zoom(Params* params) {
+    int N = params->n_of_particles;
+    int T = (int) _data.size();
+    int n_of_bins = bins();
+    double dt_snapshot = stride * params->dt_ps;
+    int k_first = (int) ceil(params->zoom_k_min * N / (2.0 * M_PI));
+    int k_last = (int) floor(params->zoom_k_max * N / (2.0 * M_PI));
+    if (channels == 2) {
+        // -k is a different wave, any N neighbouring k
+        k_last = (k_last - k_first >= N) ? k_first + N - 1 : k_last;
+    }
+    else {
+        k_first = (k_first < 0) ? 0 : k_first;
+        k_last = (k_last > N / 2) ? N / 2 : k_last;
+    }
+    int K = k_last - k_first + 1;
+    int M = (params->zoom_rows > 2) ? params->zoom_rows : 2;
+    int order = params->zoom_ar_order;
+    if (K < 1 || T < 2) {
+        printf("The zoom window holds no k of this chain\n");
+        return;
+    }
+    double theta_min = params->zoom_energy_min * dt_snapshot / params->hbar;
+    double theta_step = (params->zoom_energy_max - params->zoom_energy_min) * dt_snapshot / params->hbar / (M - 1);
+    float nyquist = M_PI * params->hbar / dt_snapshot;
+    if (fmaxf(fabsf(params->zoom_energy_min), fabsf(params->zoom_energy_max)) > nyquist) {
+        printf("The zoom window reaches past the highest recorded energy (%.3f meV)\n", nyquist);
+    }
+    printf("Zoom on %d k from %.3f to %.3f, %d energies from %.3f to %.3f meV (%s)...\n", K,
+           2.0 * M_PI * k_first / N, 2.0 * M_PI * k_last / N, M, params->zoom_energy_min, params->zoom_energy_max,
+           (order > 0) ? "Burg" : "chirp-z");
+
+    // Transform along the chain, a block of snapshots at a time, keeping the window as series[k][t]
+    int block = (T < 256) ? T : 256;
+    fftwf_complex* series = fftwf_alloc_complex((size_t) K * T);
+    float* rows = fftwf_alloc_real((size_t) block * channels * N);
+    fftwf_complex* spatial = fftwf_alloc_complex((size_t) block * n_of_bins);
+    fftwf_plan plan = nullptr;
+    if (series && rows && spatial && channels == 2) {
+        plan = fftwf_plan_many_dft(1, &N, block, (fftwf_complex*) rows, NULL, 1, N, spatial, NULL, 1, N, FFTW_FORWARD, FFTW_ESTIMATE);
+    }
+    else if (series && rows && spatial) {
+        plan = fftwf_plan_many_dft_r2c(1, &N, block, rows, NULL, 1, N, spatial, NULL, 1, n_of_bins, FFTW_ESTIMATE);
+    }
+    if (plan == nullptr) {
+        perror("Failed to plan the zoom transform");
+        fftwf_free(series);
+        fftwf_free(rows);
+        fftwf_free(spatial);
+        return;
+    }
+    for (int t0 = 0; t0 < T; t0 += block) {
+        int count = (T - t0 < block) ? T - t0 : block;
+        load(t0, count, rows);
+        fftwf_execute(plan);
+		#pragma omp parallel for
+        for (int k = 0; k < K; k++) {
+            int bin = ((k_first + k) % N + N) % N;
+            for (int j = 0; j < count; j++) {
+                series[(size_t) k * T + t0 + j][0] = spatial[(size_t) j * n_of_bins + bin][0];
+                series[(size_t) k * T + t0 + j][1] = spatial[(size_t) j * n_of_bins + bin][1];
+            }
+        }
+    }
+    fftwf_destroy_plan(plan);
+    fftwf_free(rows);
+    fftwf_free(spatial);
+
+    // Along time, one k per iteration
+    ChirpZ chirp;
+    if (order <= 0 && !chirp.plan(T, M, theta_min, theta_step)) {
+        perror("Failed to plan the chirp-z transform");
+        fftwf_free(series);
+        return;
+    }
+    std::vector<float> window(T);
+    for (int t = 0; t < T; t++) {
+        window[t] = TukeyWindow(t, T, params->window_param);
+    }
+    std::vector<float> magnitude((size_t) M * K, 0.0f);
+    float normalize = ((channels == 2) ? 1.0f : 2.0f) / ((float) T * N);
+    int failed = 0;
+	#pragma omp parallel reduction(+:failed)
+    {
+        fftwf_complex* x = fftwf_alloc_complex(T);
+        fftwf_complex* X = fftwf_alloc_complex(M);
+        fftwf_complex* work = (order <= 0) ? fftwf_alloc_complex(chirp.work_size()) : nullptr;
+        std::vector<double> a;
+        double noise;
+		#pragma omp for schedule(dynamic)
+        for (int k = 0; k < K; k++) {
+            const fftwf_complex* s = series + (size_t) k * T;
+            if (order > 0) {
+                if (!BurgAR(s, T, order, a, &noise)) {
+                    failed++;
+                    continue;
+                }
+                for (int m = 0; m < M; m++) {
+                    double theta = theta_min + m * theta_step;
+                    magnitude[(size_t) m * K + k] = sqrt(ARPower(a, noise, theta) * T) * normalize * droop_angle(theta);
+                }
+                continue;
+            }
+            for (int t = 0; t < T; t++) {
+                x[t][0] = s[t][0] * window[t];
+                x[t][1] = s[t][1] * window[t];
+            }
+            chirp.execute(x, X, work);
+            for (int m = 0; m < M; m++) {
+                magnitude[(size_t) m * K + k] = sqrtf(X[m][0] * X[m][0] + X[m][1] * X[m][1]) * normalize * droop_angle(theta_min + m * theta_step);
+            }
+        }
+        fftwf_free(x);
+        fftwf_free(X);
+        fftwf_free(work);
+    }
+    fftwf_free(series);
+    if (failed > 0) {
+        printf("%d k had too few snapshots for an order %d model\n", failed, order);
+    }
+
+    FILE* filePtr = fopen(output("result_zoom.csv").c_str(), "w");
+    if (filePtr == nullptr) {
+        perror("Couldn't create result_zoom.csv");
+        return;
+    }
+    fprintf(filePtr, "energy_meV");
+    for (int k = 0; k < K; k++) {
+        fprintf(filePtr, ",%f", 2.0 * M_PI * (k_first + k) / N);
+    }
+    fprintf(filePtr, "\n");
+    for (int m = 0; m < M; m++) {
+        fprintf(filePtr, "%f", params->zoom_energy_min + m * (params->zoom_energy_max - params->zoom_energy_min) / (M - 1));
+        for (int k = 0; k < K; k++) {
+            fprintf(filePtr, ",%f", magnitude[(size_t) m * K + k]);
+        }
+        fprintf(filePtr, "\n");
+    }
+    fclose(filePtr);
+
+    // The window has edges: its first and last k are repeated past them
+    if (params->dispersion_on) {
+        long halo = (long) GaussianTaps(params->dispersion_sigma_k).size() / 2;
+        long row_floats = K + 2 * halo;
+        std::vector<float> padded((size_t) M * row_floats);
+        float largest = 0.0f;
+        for (int m = 0; m < M; m++) {
+            for (long c = -halo; c < K + halo; c++) {
+                long k = (c < 0) ? 0 : (c >= K) ? K - 1 : c;
+                padded[(size_t) m * row_floats + halo + c] = magnitude[(size_t) m * K + k];
+                largest = fmaxf(largest, magnitude[(size_t) m * K + k]);
+            }
+        }
+        peaks.clear();
+        find_peaks(padded.data(), M, K, row_floats, false, largest, 1, M - 2, 0, params);
+        write_dispersion(0, (params->zoom_energy_max - params->zoom_energy_min) / (M - 1), params->zoom_energy_min, k_first, params);
+    }
+    if (!overlay_modes.empty()) {
+        WriteSpinWaves(output("result_lswt.csv").c_str(), overlay_modes, params);
+    }
+}
+
+// BYTES OF THE SLICE write_slice WRITES FOR A COMPRESSED RECORDING
+// RETURNS: header, snapshot offsets and coded snapshots, 0 for float32 snapshots
+size_t DataLogger::compressed_slice_bytes() const {
+    if (!_data.compressed()) {
+        return 0;
+    }
+    return sizeof(SliceHeader) + (size_t) (_data.size() + 1) * sizeof(uint64_t) + _data.frame_offset(_data.size());
+}
+
+// WRITE THE RECORDING AS ONE SLICE OF A SHARED FILE
+// The file holds float32 snapshots of the whole chain, row-major [t][site] ([t][e1, e2][site]
+// for the local frame). Each writer owns the sites [offset, offset + n_of_particles) and fills
+// them with positioned writes, so any number of processes can write their slices to the same
+// file concurrently. Compressed snapshots are written as they are coded instead: each slice is
+// one SliceHeader record at position, and the records of all slices follow each other.
+// PARAMS: (path of the shared file), (global index of the first site), (sites in the whole chain),
+//         (byte position of a compressed slice, the compressed_slice_bytes of the slices before it),
+//         (pointer to simulation params)
+// RETURNS: true if every snapshot was written
+bool DataLogger::write_slice(const char* path, long offset, long global_N, size_t position, Params* params) {
+    long N = params->n_of_particles;
+    long T = _data.size();
+    std::vector<float> snapshot(channels * N);
+
+    int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("Couldn't open the recording file");
+        return false;
+    }
+    if (_data.compressed()) {
+        SliceHeader header;
+        memcpy(header.magic, "SPSZ", 4);
+        header.codec = params->snapshot_codec;
+        header.channels = channels;
+        header.n = (int32_t) N;
+        header.offset = offset;
+        header.global_N = global_N;
+        header.T = T;
+        header.payload = _data.frame_offset(T);
+        std::vector<uint64_t> index(T + 1);
+        for (long t = 0; t <= T; t++) {
+            index[t] = _data.frame_offset(t);
+        }
+        size_t index_bytes = index.size() * sizeof(uint64_t);
+        bool ok = WriteAt(fd, &header, sizeof(header), (off_t) position)
+                  && WriteAt(fd, index.data(), index_bytes, (off_t) (position + sizeof(header)))
+                  && WriteAt(fd, _data.encoded().data(), header.payload, (off_t) (position + sizeof(header) + index_bytes));
+        if (!ok) {
+            perror("Couldn't write the recording slice");
+        }
+        close(fd);
+        return ok;
+    }
+    for (long t = 0; t < T; t++) {
+        _data.read(t, snapshot.data());
+        for (int c = 0; c < channels; c++) {
+            off_t pos = (off_t) (((t * channels + c) * global_N + offset) * sizeof(float));
+            ssize_t bytes = (ssize_t) (N * sizeof(float));
+            if (pwrite(fd, snapshot.data() + c * N, bytes, pos) != bytes) {
+                perror("Couldn't write the recording slice");
+                close(fd);
+                return false;
+            }
+        }
+    }
+    close(fd);
+    return true;
+}
+
+// A compressed slice of a recording file, with the positions of its snapshots
+struct StoredSlice {
+    SliceHeader header;
+    std::vector<uint64_t> index; // T + 1 offsets in the payload
+    off_t payload; // where the payload starts in the file
+};
+
+// READ THE SLICE RECORDS OF A COMPRESSED RECORDING
+// PARAMS: (open file), (its length), (sites and channels expected), (output: slices by first site)
+// RETURNS: false if the records are damaged or don't tile the chain with the same snapshots
+static bool ReadSlices(int fd, off_t length, long N, int channels, std::vector<StoredSlice>& slices) {
+    off_t position = 0;
+    while (position < length) {
+        StoredSlice slice;
+        if (!ReadAt(fd, &slice.header, sizeof(SliceHeader), position) || memcmp(slice.header.magic, "SPSZ", 4) != 0
+            || slice.header.T < 0) {
+            return false;
+        }
+        slice.index.resize(slice.header.T + 1);
+        if (!ReadAt(fd, slice.index.data(), slice.index.size() * sizeof(uint64_t), position + (off_t) sizeof(SliceHeader))) {
+            return false;
+        }
+        slice.payload = position + (off_t) (sizeof(SliceHeader) + slice.index.size() * sizeof(uint64_t));
+        position = slice.payload + (off_t) slice.header.payload;
+        slices.push_back(slice);
+    }
+    std::sort(slices.begin(), slices.end(), [](const StoredSlice& a, const StoredSlice& b) { return a.header.offset < b.header.offset; });
+    long next = 0;
+    for (const StoredSlice& slice : slices) {
+        const SliceHeader& header = slice.header;
+        if (header.offset != next || header.global_N != N || header.channels != channels || header.T != slices[0].header.T) {
+            return false;
+        }
+        next += header.n;
+    }
+    return next == N;
+}
+
+// SPECTRUM OF A RECORDING FILE WRITTEN BY write_slice
+// The file is read a block of snapshots at a time and transformed out of core, so it can be
+// far larger than the memory. Without params->analysis_memory_mb the whole transform is done in
+// one block. Compressed slices are decoded a block of snapshots at a time as they are read.
+// PARAMS: (path of the file), (pointer to the params of the whole chain)
+// RETURNS: false if the file couldn't be read or transformed
+bool DataLogger::analyze_recording(const char* path, Params* params) {
+    set_layout(params);
+    int N = params->n_of_particles;
+    int width = channels * N;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Couldn't open the recording file");
+        return false;
+    }
+    off_t length = lseek(fd, 0, SEEK_END);
+    char magic[4] = { 0 };
+    bool compressed = ReadAt(fd, magic, 4, 0) && memcmp(magic, "SPSZ", 4) == 0;
+    std::vector<StoredSlice> slices;
+    if (compressed && !ReadSlices(fd, length, N, channels, slices)) {
+        printf("%s is not a compressed recording of %d sites with %d channels\n", path, N, channels);
+        close(fd);
+        return false;
+    }
+    long T = compressed ? (long) slices[0].header.T : (long) (length / ((off_t) width * sizeof(float)));
+    if (T < 2) {
+        printf("%s holds less than two snapshots of %d sites\n", path, N);
+        close(fd);
+        return false;
+    }
+    Params whole = *params;
+    if (whole.analysis_memory_mb <= 0) {
+        size_t needed = (size_t) T * width * sizeof(float) + (size_t) T * bins() * sizeof(fftwf_complex);
+        whole.analysis_memory_mb = (int) (needed >> 20) + 1;
+    }
+
+    // the file has planes of e1 and e2 for the local frame, the transform wants them interleaved
+    bool ok = true;
+    std::vector<float> component(channels == 2 ? width : 0);
+    std::vector<uint8_t> coded;
+    RowReader decode = [&](long first, long count, float* rows) {
+        for (const StoredSlice& slice : slices) {
+            const SliceHeader& header = slice.header;
+            uint64_t begin = slice.index[first], end = slice.index[first + count];
+            coded.resize(end - begin);
+            if (!ReadAt(fd, coded.data(), coded.size(), slice.payload + (off_t) begin)) {
+                ok = false;
+                memset(rows, 0, (size_t) count * width * sizeof(float));
+                return;
+            }
+            int values = header.channels * header.n;
+			#pragma omp parallel
+            {
+                std::vector<float> planes(values);
+				#pragma omp for
+                for (long t = 0; t < count; t++) {
+                    SnapshotStore::decode_frame(header.codec, values, &coded[slice.index[first + t] - begin],
+                                                slice.index[first + t + 1] - slice.index[first + t], planes.data());
+                    float* row = rows + (size_t) t * width;
+                    for (int i = 0; i < header.n; i++) {
+                        for (int c = 0; c < channels; c++) {
+                            row[channels * (header.offset + i) + c] = planes[(size_t) c * header.n + i];
+                        }
+                    }
+                }
+            }
+        }
+    };
+    RowReader read = compressed ? decode : [&](long first, long count, float* rows) {
+        size_t bytes = (size_t) count * width * sizeof(float);
+        if (!ReadAt(fd, rows, bytes, (off_t) ((size_t) first * width * sizeof(float)))) {
+            ok = false;
+            memset(rows, 0, bytes);
+            return;
+        }
+        for (long t = 0; t < count && channels == 2; t++) {
+            float* row = rows + (size_t) t * width;
+            memcpy(component.data(), row, width * sizeof(float));
+            for (int i = 0; i < N; i++) {
+                row[2 * i] = component[i];
+                row[2 * i + 1] = component[N + i];
+            }
+        }
+    };
+    bool done = transform_out_of_core(read, T, &whole);
+    close(fd);
+    if (!ok) {
+        perror("Couldn't read the recording file");
+    }
+    return done && ok;
+}
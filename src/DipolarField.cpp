@@ -0,0 +1,119 @@
+#include "utils.h"
+#include "DipolarField.h"
+#include <fftw3.h>
+#include <vector>
+#include <cstdio>
+#include <math.h>
+
+DipolarField::~DipolarField() {
+    release();
+}
+
+void DipolarField::release() {
+    if (forward) fftwf_destroy_plan(forward);
+    if (backward) fftwf_destroy_plan(backward);
+    fftwf_free(in);
+    fftwf_free(out);
+    fftwf_free(spectrum);
+    forward = backward = nullptr;
+    in = out = nullptr;
+    spectrum = nullptr;
+    N = n_pad = 0;
+}
+
+// PLAN THE TRANSFORMS AND PRECOMPUTE THE KERNEL FOR A CHAIN OF n_of_particles SITES
+// PARAMS: (number of sites)
+// RETURNS: false if the buffers or plans couldn't be created
+bool DipolarField::resize(int n_of_particles) {
+    if (n_of_particles == N && forward != nullptr) {
+        return true;
+    }
+    release();
+    N = n_of_particles;
+    n_pad = 2 * N;
+    int n_of_bins = n_pad / 2 + 1;
+
+    in = fftwf_alloc_real(3 * n_pad);
+    out = fftwf_alloc_real(3 * n_pad);
+    spectrum = fftwf_alloc_complex(3 * n_of_bins);
+    if (!in || !out || !spectrum) {
+        perror("Failed to allocate space for the dipolar field\n");
+        release();
+        return false;
+    }
+
+    // three transforms of length n_pad, one per spin component
+    forward = fftwf_plan_many_dft_r2c(1, &n_pad, 3, in, nullptr, 1, n_pad, spectrum, nullptr, 1, n_of_bins, FFTW_ESTIMATE);
+    backward = fftwf_plan_many_dft_c2r(1, &n_pad, 3, spectrum, nullptr, 1, n_of_bins, out, nullptr, 1, n_pad, FFTW_ESTIMATE);
+    if (forward == NULL || backward == NULL) {
+        perror("Failed to create plan for the dipolar field\n");
+        release();
+        return false;
+    }
+
+    // Kernel 1/|n|^3 at lags -(N-1)..(N-1) in wrap-around order, the lag N stays empty
+    for (int i = 0; i < 3 * n_pad; i++) {
+        in[i] = 0.0f;
+    }
+    for (int n = 1; n < N; n++) {
+        float r3 = 1.0f / ((float) n * n * n);
+        in[n] = r3;
+        in[n_pad - n] = r3;
+    }
+    fftwf_execute(forward);
+    kernel.resize(n_of_bins);
+    float normalize = 1.0f / n_pad;
+    for (int k = 0; k < n_of_bins; k++) {
+        kernel[k] = spectrum[k][0] * normalize;
+    }
+    in[0] = 0.0f;
+    for (int n = 1; n < N; n++) {
+        in[n] = 0.0f;
+        in[n_pad - n] = 0.0f;
+    }
+    return true;
+}
+
+// CALCULATE THE DIPOLAR FIELD OF EVERY SITE
+// For a chain along x the field is D * sum_j (3 (S_j . x) x - S_j) / |i - j|^3
+// PARAMS: (reference to a vector of the sites), (pointer to simulation params), (output field per site)
+void DipolarField::compute(const FirstTouchVector<Particle>& particles, Params* params, FirstTouchVector<Vector3>& field) {
+    int n_of_particles = params->n_of_particles;
+    field.resize(n_of_particles);
+    if (!resize(n_of_particles)) {
+        for (int i = 0; i < n_of_particles; i++) {
+            field[i] = Vector3Zero();
+        }
+        return;
+    }
+    int n_of_bins = n_pad / 2 + 1;
+
+    // The padding half of every component stays zero
+	#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++) {
+        in[i] = particles[i].spin.x;
+        in[n_pad + i] = particles[i].spin.y;
+        in[2 * n_pad + i] = particles[i].spin.z;
+    }
+
+    fftwf_execute(forward);
+
+    // The xx part of the tensor is 2/|n|^3, the yy and zz parts -1/|n|^3
+    float D = params->dipolar_D;
+    float scale[3] = { 2.0f * D, -D, -D };
+	#pragma omp parallel for schedule(static)
+    for (int k = 0; k < n_of_bins; k++) {
+        for (int c = 0; c < 3; c++) {
+            float factor = kernel[k] * scale[c];
+            spectrum[c * n_of_bins + k][0] *= factor;
+            spectrum[c * n_of_bins + k][1] *= factor;
+        }
+    }
+
+    fftwf_execute(backward);
+
+	#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++) {
+        field[i] = (Vector3) { out[i], out[n_pad + i], out[2 * n_pad + i] };
+    }
+}
@@ -0,0 +1,169 @@
+#include "Dispersion.h"
+#include <algorithm>
+#include <cstring>
+#include <math.h>
+
+// NORMALIZED TAPS OF A GAUSSIAN
+// PARAMS: (standard deviation in bins, 0 for no smoothing)
+// RETURNS: 2r + 1 taps for r = ceil(3 sigma), centred on tap r
+std::vector<float> GaussianTaps(float sigma) {
+    if (sigma <= 0.0f) {
+        return std::vector<float>(1, 1.0f);
+    }
+    int radius = (int) ceilf(3.0f * sigma);
+    std::vector<float> taps(2 * radius + 1);
+    float sum = 0.0f;
+    for (int j = -radius; j <= radius; j++) {
+        taps[j + radius] = expf(-0.5f * j * j / (sigma * sigma));
+        sum += taps[j + radius];
+    }
+    for (float& tap : taps) {
+        tap /= sum;
+    }
+    return taps;
+}
+
+// DECIBEL-LIKE SCALE: log10 OF EVERY VALUE, FLOORED SO EMPTY BINS DON'T GO TO -INFINITY
+// PARAMS: (values, replaced), (number of values), (smallest value kept)
+void LogScale(float* values, size_t count, float floor) {
+	#pragma omp parallel for simd schedule(static)
+    for (size_t i = 0; i < count; i++) {
+        values[i] = log10f(fmaxf(values[i], floor));
+    }
+}
+
+// ONE ROW SMOOTHED ALONG k
+// PARAMS: (row with the padding columns), (columns of the result), (taps), (output: cols values)
+static void SmoothAlongK(const float* source, long cols, const std::vector<float>& col_taps, float* target) {
+    for (long c = 0; c < cols; c++) {
+        target[c] = 0.0f;
+    }
+    for (size_t j = 0; j < col_taps.size(); j++) {
+        float tap = col_taps[j];
+        const float* shifted = source + j;
+		#pragma omp simd
+        for (long c = 0; c < cols; c++) {
+            target[c] += tap * shifted[c];
+        }
+    }
+}
+
+// SEPARABLE GAUSSIAN SMOOTHING OF A MAP, IN PLACE
+// Both passes add shifted copies of whole rows, so the inner loops run over contiguous columns
+// and vectorize. The map carries col_taps.size() / 2 extra columns on both sides (neighbouring k,
+// filled by the caller), so the pass along k needs no edge cases. Along the rows the map either
+// wraps around (the energies of an FFT) or its edge rows are repeated.
+// The rows are smoothed a block at a time, from a window of the rows around the block smoothed
+// along k. Row t of the result is packed at t * cols, over rows of the map up to t only, so the
+// rows of the later blocks are still intact. The rows the window needs from before the block
+// come from the previous window, and the first rows (where the last ones wrap to) are kept aside.
+// PARAMS: (map with the padding columns, replaced by the result: rows x cols), (rows), (floats
+//         from one row of the map to the next), (columns of the result), (true if the rows are
+//         periodic), (taps along the rows), (taps along the columns)
+void GaussianSmooth(float* map, long rows, long stride, long cols, bool wrap_rows,
+                    const std::vector<float>& row_taps, const std::vector<float>& col_taps) {
+    long radius = (long) row_taps.size() / 2;
+    long block = (radius > 256) ? radius : 256;
+    long head_rows = wrap_rows ? ((radius < rows) ? radius : rows) : 0;
+    std::vector<float> head((size_t) head_rows * cols);
+	#pragma omp parallel for schedule(static)
+    for (long t = 0; t < head_rows; t++) {
+        SmoothAlongK(map + (size_t) t * stride, cols, col_taps, &head[(size_t) t * cols]);
+    }
+
+    std::vector<float> window((size_t) (block + 2 * radius) * cols);
+    std::vector<float> previous(window.size());
+    for (long t0 = 0; t0 < rows; t0 += block) {
+        long t1 = (rows - t0 < block) ? rows : t0 + block;
+        std::swap(window, previous);
+
+        // rows t0 - radius ... t1 + radius - 1 along k
+		#pragma omp parallel for schedule(static)
+        for (long w = 0; w < t1 - t0 + 2 * radius; w++) {
+            long row = t0 - radius + w;
+            if (wrap_rows) {
+                row = ((row % rows) + rows) % rows;
+            }
+            else {
+                row = (row < 0) ? 0 : (row >= rows) ? rows - 1 : row;
+            }
+            float* target = &window[(size_t) w * cols];
+            if (row >= t0) {
+                SmoothAlongK(map + (size_t) row * stride, cols, col_taps, target);
+            }
+            else if (row < head_rows) {
+                memcpy(target, &head[(size_t) row * cols], cols * sizeof(float));
+            }
+            else {
+                memcpy(target, &previous[(size_t) (row - t0 + block + radius) * cols], cols * sizeof(float));
+            }
+        }
+
+		#pragma omp parallel for schedule(static)
+        for (long t = t0; t < t1; t++) {
+            float* target = map + (size_t) t * cols;
+            for (long c = 0; c < cols; c++) {
+                target[c] = 0.0f;
+            }
+            for (long j = -radius; j <= radius; j++) {
+                float tap = row_taps[j + radius];
+                const float* source = &window[(size_t) (t - t0 + radius + j) * cols];
+				#pragma omp simd
+                for (long c = 0; c < cols; c++) {
+                    target[c] += tap * source[c];
+                }
+            }
+        }
+    }
+}
+
+// PEAKS ALONG THE ROWS OF EVERY COLUMN OF A LOG-SCALED MAP
+// A peak is a row above both its neighbours. On a log scale a Gaussian peak is a parabola, so
+// the parabola through the peak row and its neighbours gives its position and height between
+// the rows. The width is where the map falls to half the height (log10 2 below it), interpolated
+// between the rows on both sides.
+// PARAMS: (log10 of the smoothed map), (rows), (columns), (first and last row searched, their
+//         neighbours must be in the map), (lowest log10 height kept), (most peaks kept per
+//         column, the highest), (output: peaks appended column by column, by row within a column)
+void FindPeaks(const float* map, long rows, long cols, long first_row, long last_row, float threshold,
+               int per_column, std::vector<DispersionPeak>& peaks) {
+    first_row = (first_row < 1) ? 1 : first_row;
+    last_row = (last_row > rows - 2) ? rows - 2 : last_row;
+    std::vector<std::vector<DispersionPeak>> found(cols);
+    const float half = log10f(2.0f);
+
+	#pragma omp parallel for schedule(dynamic, 16)
+    for (long c = 0; c < cols; c++) {
+        auto at = [&](long t) { return map[(size_t) t * cols + c]; };
+        std::vector<DispersionPeak>& column = found[c];
+        for (long t = first_row; t <= last_row; t++) {
+            float below = at(t - 1), top = at(t), above = at(t + 1);
+            if (!(top > below && top >= above && top >= threshold)) {
+                continue;
+            }
+            float curvature = below - 2.0f * top + above;
+            double shift = (curvature < 0.0f) ? 0.5 * (below - above) / curvature : 0.0;
+            double height = top - 0.25 * (below - above) * shift;
+            double level = height - half;
+
+            long left = t;
+            while (left > 0 && at(left) > level) left--;
+            double left_edge = (at(left) <= level) ? left + (level - at(left)) / (at(left + 1) - at(left)) : left;
+            long right = t;
+            while (right < rows - 1 && at(right) > level) right++;
+            double right_edge = (at(right) <= level) ? right - (level - at(right)) / (at(right - 1) - at(right)) : right;
+
+            column.push_back((DispersionPeak) { c, t + shift, right_edge - left_edge, powf(10.0f, (float) height) });
+        }
+        if (per_column > 0 && (int) column.size() > per_column) {
+            std::sort(column.begin(), column.end(),
+                      [](const DispersionPeak& a, const DispersionPeak& b) { return a.amplitude > b.amplitude; });
+            column.resize(per_column);
+        }
+        std::sort(column.begin(), column.end(),
+                  [](const DispersionPeak& a, const DispersionPeak& b) { return a.row < b.row; });
+    }
+    for (const std::vector<DispersionPeak>& column : found) {
+        peaks.insert(peaks.end(), column.begin(), column.end());
+    }
+}
@@ -0,0 +1,211 @@
+#include "GroundStateLibrary.h"
+#include "SpinWaves.h"
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <functional>
+#include <thread>
+
+// header of a stored ground state, followed by n spins
+struct GroundStateHeader {
+    char magic[4]; // "SPGS"
+    int32_t version;
+    int32_t n;
+    float J1;
+    float J2;
+    int32_t dipolar_on;
+    float dipolar_D;
+    int32_t open_ends;
+    float energy;
+};
+
+static const int32_t GROUND_STATE_VERSION = 2;
+
+GroundStateLibrary::GroundStateLibrary(const std::string& directory) : directory(directory) {
+    mkdir(directory.c_str(), 0755);
+}
+
+std::string GroundStateLibrary::path(uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof(name), "/gs_%016llx.bin", (unsigned long long) key);
+    return directory + name;
+}
+
+// HASH OF EVERYTHING THE RELAXED STATE DEPENDS ON
+// The pulse, the recording and the damping don't change the ground state so they are left out.
+// PARAMS: (pointer to simulation params)
+// RETURNS: 64-bit FNV-1a hash
+uint64_t GroundStateLibrary::key(Params* params) {
+    char text[128];
+    snprintf(text, sizeof(text), "v%d n=%d J1=%.9g J2=%.9g D=%.9g open=%d", GROUND_STATE_VERSION, params->n_of_particles,
+             params->J1, params->J2, params->dipolar_on ? params->dipolar_D : 0.0f, (int) params->open_ends);
+    uint64_t hash = 14695981039346656037ull;
+    for (const char* c = text; *c; c++) {
+        hash = (hash ^ (unsigned char) *c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// ROTATE v AROUND THE UNIT VECTOR n
+static Vector3 Rotate(Vector3 v, Vector3 n, double angle) {
+    float c = (float) cos(angle);
+    float s = (float) sin(angle);
+    return Vector3Add(Vector3Add(Vector3Scale(v, c), Vector3Scale(Vector3CrossProduct(n, v), s)),
+                      Vector3Scale(n, Vector3DotProduct(n, v) * (1.0f - c)));
+}
+
+static bool ReadGroundState(const std::string& path, GroundStateHeader& header, std::vector<Vector3>* spins) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && !memcmp(header.magic, "SPGS", 4)
+              && header.version == GROUND_STATE_VERSION && header.n > 0;
+    if (ok && spins != nullptr) {
+        spins->resize(header.n);
+        ok = fread(spins->data(), sizeof(Vector3), header.n, file) == (size_t) header.n;
+    }
+    fclose(file);
+    return ok;
+}
+
+// COUPLINGS IN UNITS OF THE LENGTH OF (J1, J2)
+// Only their ratios shape the ground state. Dividing by J1 alone would blow up at J1 = 0.
+// PARAMS: (J1), (J2), (dipolar D, 0 without it), (output: J1, J2 and D scaled)
+static void ScaledCouplings(float J1, float J2, float D, double scaled[3]) {
+    double length = sqrt((double) J1 * J1 + (double) J2 * J2);
+    if (length == 0.0) {
+        length = 1.0;
+    }
+    scaled[0] = J1 / length;
+    scaled[1] = J2 / length;
+    scaled[2] = D / length;
+}
+
+// START FROM THE CLOSEST STORED GROUND STATE
+// Closeness is the distance between the scaled couplings (J1, J2, D) / |(J1, J2)|, states of the
+// same length are preferred, the sign of J1 and the ends must match. The spiral is then turned to the pitch expected for the new
+// parameters: the same chain is rotated site by site around the spiral normal, which keeps
+// any distortion of the stored state, a chain of another length gets a uniform spiral.
+// PARAMS: (reference to the vector of sites, filled on success), (pointer to simulation params)
+// RETURNS: false if the library has nothing usable, the sites are left untouched then
+bool GroundStateLibrary::warm_start(FirstTouchVector<Particle>& particles, Params* params) {
+    int N = params->n_of_particles;
+    double wanted[3];
+    ScaledCouplings(params->J1, params->J2, params->dipolar_on ? params->dipolar_D : 0.0f, wanted);
+
+    std::string best_path;
+    GroundStateHeader best;
+    double best_distance = 1e30;
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return false;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        size_t length = strlen(entry->d_name);
+        if (strncmp(entry->d_name, "gs_", 3) != 0 || length < 4 || strcmp(entry->d_name + length - 4, ".bin") != 0) continue;
+        std::string candidate = directory + "/" + entry->d_name;
+        GroundStateHeader header;
+        if (!ReadGroundState(candidate, header, nullptr)) continue;
+        if ((header.J1 < 0.0f) != (params->J1 < 0.0f) || (header.dipolar_on != 0) != params->dipolar_on
+            || (header.open_ends != 0) != params->open_ends) continue;
+        double stored[3];
+        ScaledCouplings(header.J1, header.J2, header.dipolar_D, stored);
+        double distance = fabs(stored[0] - wanted[0]) + fabs(stored[1] - wanted[1]) + fabs(stored[2] - wanted[2])
+                          + (header.n != N ? 1.0 : 0.0);
+        if (distance < best_distance) {
+            best_distance = distance;
+            best_path = candidate;
+            best = header;
+        }
+    }
+    closedir(dir);
+
+    std::vector<Vector3> spins;
+    if (best_path.empty() || !ReadGroundState(best_path, best, &spins)) {
+        return false;
+    }
+
+    // pitch of the stored chain and the shift predicted by the classical spiral
+    FirstTouchVector<Particle> stored(best.n);
+    for (int i = 0; i < best.n; i++) {
+        stored[i].spin = spins[i];
+    }
+    Params stored_params = *params;
+    stored_params.n_of_particles = best.n;
+    float spread;
+    double Q_old = SpiralPitch(stored, &stored_params, &spread);
+    double Q_new = Q_old + ClassicalPitch(params->J1, params->J2) - ClassicalPitch(best.J1, best.J2);
+    // a periodic chain only fits whole turns
+    if (!params->open_ends) {
+        Q_old = 2.0 * M_PI * round(Q_old * best.n / (2.0 * M_PI)) / best.n;
+        Q_new = 2.0 * M_PI * round(Q_new * N / (2.0 * M_PI)) / N;
+    }
+
+    // normal of the spiral plane, for a collinear chain any direction perpendicular to the spins
+    Vector3 normal = Vector3Zero();
+    for (int i = 0; i < best.n; i++) {
+        normal = Vector3Add(normal, Vector3CrossProduct(spins[i], spins[(i + 1) % best.n]));
+    }
+    if (Vector3Length(normal) < 1e-6f * best.n) {
+        Vector3 axis = (Vector3) {0, 0, 1};
+        normal = Vector3Subtract(axis, Vector3Scale(spins[0], Vector3DotProduct(axis, spins[0])));
+        if (Vector3Length(normal) < 1e-3f) {
+            normal = Vector3CrossProduct(spins[0], (Vector3) {1, 0, 0});
+        }
+    }
+    normal = Vector3Normalize(normal);
+
+    // a new array, so its first touch is partitioned over exactly N sites
+    FirstTouchVector<Particle>(N).swap(particles);
+    float distance = 100.0f / N;
+    for (int i = 0; i < N; i++) {
+        Vector3 spin = (best.n == N) ? Rotate(spins[i], normal, (Q_new - Q_old) * i)
+                                     : Rotate(spins[0], normal, Q_new * i);
+        particles[i] = (Particle) { (Vector3) { (float) i * distance, 0, 0 }, Vector3Normalize(spin) };
+    }
+    printf("Warm start from %s (n = %d, J1 = %f, J2 = %f), pitch %f -> %f\n",
+           best_path.c_str(), best.n, best.J1, best.J2, Q_old, Q_new);
+    return true;
+}
+
+// SAVE A RELAXED CHAIN
+// Written to a temporary file and renamed, so runs reading the library at the same time
+// never see half a state.
+// PARAMS: (reference to the vector of relaxed sites), (pointer to simulation params)
+// RETURNS: false if the file couldn't be written
+bool GroundStateLibrary::store(const FirstTouchVector<Particle>& particles, Params* params) {
+    GroundStateHeader header;
+    memcpy(header.magic, "SPGS", 4);
+    header.version = GROUND_STATE_VERSION;
+    header.n = params->n_of_particles;
+    header.J1 = params->J1;
+    header.J2 = params->J2;
+    header.dipolar_on = params->dipolar_on;
+    header.dipolar_D = params->dipolar_on ? params->dipolar_D : 0.0f;
+    header.open_ends = params->open_ends;
+    header.energy = getTotalEnergy(particles, params);
+
+    std::vector<Vector3> spins(header.n);
+    for (int i = 0; i < header.n; i++) {
+        spins[i] = particles[i].spin;
+    }
+    std::string target = path(key(params));
+    std::string temporary = target + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr) {
+        perror("Couldn't write the ground state");
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+              && fwrite(spins.data(), sizeof(Vector3), header.n, file) == (size_t) header.n;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(temporary.c_str(), target.c_str()) != 0) {
+        perror("Couldn't write the ground state");
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,138 @@
+#include "LiveExport.h"
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+LiveExport::~LiveExport() {
+    close();
+}
+
+// CREATE THE SHARED MEMORY AND ITS RING OF SLOTS
+// A segment left behind under the same name (by a run that crashed, or an earlier run with
+// another chain length) is replaced. Readers of the old one see its writer gone.
+// PARAMS: (name, starting with '/'), (sites per frame), (global index of the first site),
+//         (sites of the whole chain), (number of slots), (pointer to simulation params)
+// RETURNS: false if the memory couldn't be created, the export stays closed then
+bool LiveExport::open(const char* name, long n_sites, long first_site, long total_sites, int n_slots, Params* params) {
+    close();
+    if (n_sites <= 0 || n_slots < 2) {
+        return false;
+    }
+    uint64_t slot_bytes = LiveSlotBytes(n_sites);
+    size_t size = LiveHeaderBytes() + n_slots * slot_bytes;
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        perror("Couldn't create the live export");
+        return false;
+    }
+    if (ftruncate(fd, size) != 0) {
+        perror("Couldn't size the live export");
+        ::close(fd);
+        fd = -1;
+        shm_unlink(name);
+        return false;
+    }
+    base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("Couldn't map the live export");
+        base = nullptr;
+        ::close(fd);
+        fd = -1;
+        shm_unlink(name);
+        return false;
+    }
+    this->name = name;
+    bytes = size;
+    frames = 0;
+    last_time = -1e30;
+
+    // the new memory is zero, so every slot starts with sequence 0 (no frame)
+    header = new (base) LiveHeader();
+    header->version = LIVE_VERSION;
+    header->n_sites = n_sites;
+    header->first_site = first_site;
+    header->total_sites = total_sites;
+    header->n_slots = n_slots;
+    header->writer_pid = (uint32_t) getpid();
+    header->slot_bytes = slot_bytes;
+    header->dt_ps = params->dt_ps;
+    header->J1 = params->J1;
+    header->J2 = params->J2;
+    header->latest.store(0, std::memory_order_relaxed);
+    header->closed.store(0, std::memory_order_relaxed);
+    header->magic.store(LIVE_MAGIC, std::memory_order_release);
+    return true;
+}
+
+// MARK THE SEGMENT CLOSED AND REMOVE ITS NAME
+// Readers that still have it mapped keep their view until they let go of it.
+void LiveExport::close() {
+    if (base == nullptr) {
+        return;
+    }
+    header->closed.store(1, std::memory_order_release);
+    munmap(base, bytes);
+    ::close(fd);
+    shm_unlink(name.c_str());
+    base = nullptr;
+    header = nullptr;
+    fd = -1;
+}
+
+bool LiveExport::is_open() const {
+    return base != nullptr;
+}
+
+// IS IT TIME FOR THE NEXT FRAME
+// PARAMS: (simulated time), (pointer to simulation params)
+// RETURNS: true once live_export_interval_ps has passed since the last published frame,
+//          or if the clock was set back
+bool LiveExport::due(double time_ps, Params* params) const {
+    return base != nullptr && (time_ps - last_time >= params->live_export_interval_ps || time_ps < last_time);
+}
+
+// WRITE THE NEXT FRAME
+// The sequence of the slot is made odd before anything in it changes and even again with
+// release order after the last spin, so a reader that sees the same even number before
+// and after its reads knows they are one whole frame.
+// PARAMS: (pointer to the first site of the frame), (simulated time), (total energy or NaN),
+//         (LIVE_* flags), (pointer to simulation params)
+void LiveExport::publish(const Particle* sites, double time_ps, float energy, uint32_t flags, Params* params) {
+    if (base == nullptr) {
+        return;
+    }
+    uint64_t frame = ++frames;
+    LiveSlot* slot = (LiveSlot*) ((char*) base + LiveHeaderBytes() + (frame % header->n_slots) * header->slot_bytes);
+    float* spins = (float*) ((char*) slot + LiveSpinOffset());
+    long n = (long) header->n_sites;
+
+    slot->sequence.store(2 * frame - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    double mx = 0.0, my = 0.0, mz = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:mx, my, mz) if (n > 100000)
+    for (long i = 0; i < n; i++) {
+        Vector3 spin = sites[i].spin;
+        spins[3 * i] = spin.x;
+        spins[3 * i + 1] = spin.y;
+        spins[3 * i + 2] = spin.z;
+        mx += spin.x;
+        my += spin.y;
+        mz += spin.z;
+    }
+    slot->frame = frame;
+    slot->step = params->step_counter;
+    slot->time_ps = time_ps;
+    slot->energy = energy;
+    slot->magnetization[0] = (float) (mx / n);
+    slot->magnetization[1] = (float) (my / n);
+    slot->magnetization[2] = (float) (mz / n);
+    slot->external_field = params->ext_field_on ? params->external_field : 0.0f;
+    slot->flags = flags | (params->ext_field_on ? LIVE_FIELD_ON : 0u);
+    slot->sequence.store(2 * frame, std::memory_order_release);
+    header->latest.store(frame, std::memory_order_release);
+    last_time = time_ps;
+}
@@ -0,0 +1,162 @@
+#include "LiveReader.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+LiveReader::~LiveReader() {
+    close();
+}
+
+// MAP A LIVE EXPORT READ-ONLY
+// PARAMS: (name the simulation exports under, LIVE_DEFAULT_NAME for the GUI)
+// RETURNS: false if there is no complete export of a known version under that name
+bool LiveReader::open(const char* name) {
+    close();
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t) status.st_size < LiveHeaderBytes()) {
+        close();
+        return false;
+    }
+    bytes = status.st_size;
+    base = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        base = nullptr;
+        close();
+        return false;
+    }
+    header = (const LiveHeader*) base;
+    if (header->magic.load(std::memory_order_acquire) != LIVE_MAGIC || header->version != LIVE_VERSION
+        || LiveHeaderBytes() + header->n_slots * header->slot_bytes > bytes) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void LiveReader::close() {
+    if (base != nullptr) {
+        munmap((void*) base, bytes);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    base = nullptr;
+    header = nullptr;
+    fd = -1;
+}
+
+bool LiveReader::is_open() const {
+    return base != nullptr;
+}
+
+// RETURNS: the layout of the export (sites, slots, couplings), nullptr when not open
+const LiveHeader* LiveReader::info() const {
+    return header;
+}
+
+// IS THE SIMULATION STILL PUBLISHING
+// RETURNS: false once the writer closed the export or its process is gone
+bool LiveReader::writer_alive() const {
+    if (header == nullptr || header->closed.load(std::memory_order_acquire)) {
+        return false;
+    }
+    return kill((pid_t) header->writer_pid, 0) == 0 || errno == EPERM;
+}
+
+const LiveSlot* LiveReader::slot_of(uint64_t frame) const {
+    return (const LiveSlot*) ((const char*) base + LiveHeaderBytes() + (frame % header->n_slots) * header->slot_bytes);
+}
+
+// POINT A FRAME AT ITS SLOT IF THE SLOT HOLDS IT COMPLETELY
+bool LiveReader::view(uint64_t frame, LiveFrame* result) const {
+    const LiveSlot* slot = slot_of(frame);
+    if (slot->sequence.load(std::memory_order_acquire) != 2 * frame) {
+        return false;
+    }
+    result->frame = frame;
+    result->slot = slot;
+    result->spins = (const float*) ((const char*) slot + LiveSpinOffset());
+    return true;
+}
+
+// THE NEWEST COMPLETE FRAME
+// PARAMS: (pointer to the frame to fill)
+// RETURNS: false if nothing was published yet
+bool LiveReader::latest(LiveFrame* result) const {
+    if (header == nullptr) {
+        return false;
+    }
+    // the writer can overtake between the two loads, then look again
+    for (int attempt = 0; attempt < 16; attempt++) {
+        uint64_t frame = header->latest.load(std::memory_order_acquire);
+        if (frame == 0) {
+            return false;
+        }
+        if (view(frame, result)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// THE OLDEST FRAME AFTER A GIVEN ONE THAT IS STILL IN THE RING
+// Following frames with next(previous.frame) sees every frame as long as the reader keeps up.
+// If it falls behind, frames are skipped, which shows as a jump in LiveFrame::frame.
+// PARAMS: (last frame seen, 0 for none), (pointer to the frame to fill)
+// RETURNS: false if there is nothing newer yet
+bool LiveReader::next(uint64_t after, LiveFrame* result) const {
+    if (header == nullptr) {
+        return false;
+    }
+    uint64_t newest = header->latest.load(std::memory_order_acquire);
+    if (newest <= after) {
+        return false;
+    }
+    // the slot after the newest frame may already be under way
+    uint64_t oldest = (newest + 2 > header->n_slots) ? newest + 2 - header->n_slots : 1;
+    for (uint64_t frame = (after + 1 > oldest) ? after + 1 : oldest; frame <= newest; frame++) {
+        if (view(frame, result)) {
+            return true;
+        }
+    }
+    return latest(result) && result->frame > after;
+}
+
+// WERE THE VALUES READ FROM A FRAME ALL FROM THAT FRAME
+// PARAMS: (frame from latest or next, after reading what was needed from it)
+// RETURNS: false if the writer has started to overwrite the slot since
+bool LiveReader::valid(const LiveFrame& frame) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return frame.slot != nullptr && frame.slot->sequence.load(std::memory_order_relaxed) == 2 * frame.frame;
+}
+
+// COPY A FRAME OUT OF THE RING, FOR READERS THAT HOLD ON TO IT
+// PARAMS: (frame), (pointer to the observables to fill or nullptr), (pointer to 3 * n_sites floats or nullptr)
+// RETURNS: false if the frame was overwritten during the copy
+bool LiveReader::copy(const LiveFrame& frame, LiveSlot* observables, float* spins) const {
+    if (frame.slot == nullptr) {
+        return false;
+    }
+    if (observables != nullptr) {
+        observables->frame = frame.slot->frame;
+        observables->step = frame.slot->step;
+        observables->time_ps = frame.slot->time_ps;
+        observables->energy = frame.slot->energy;
+        memcpy(observables->magnetization, frame.slot->magnetization, sizeof(observables->magnetization));
+        observables->external_field = frame.slot->external_field;
+        observables->flags = frame.slot->flags;
+    }
+    if (spins != nullptr) {
+        memcpy(spins, frame.spins, header->n_sites * 3 * sizeof(float));
+    }
+    return valid(frame);
+}
@@ -0,0 +1,128 @@
+#include "Numa.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <pthread.h>
+
+// cpus the process was started with, before any thread was pinned
+static cpu_set_t allowed_cpus;
+static bool have_allowed_cpus = false;
+
+static const cpu_set_t& AllowedCpus() {
+    if (!have_allowed_cpus) {
+        CPU_ZERO(&allowed_cpus);
+        sched_getaffinity(0, sizeof(cpu_set_t), &allowed_cpus);
+        have_allowed_cpus = true;
+    }
+    return allowed_cpus;
+}
+
+// ALLOWED CPUS GROUPED BY NUMA NODE
+// Read from /sys/devices/system/node/node<i>/cpulist ("0-15,32-47"). Without the directory
+// (no NUMA support in the kernel) all cpus are one node.
+// RETURNS: one list of cpus per node that has any the process may use
+static std::vector<std::vector<int>> NodeCpus() {
+    const cpu_set_t& allowed = AllowedCpus();
+    std::vector<std::vector<int>> nodes;
+    for (int node = 0; node < 1024; node++) {
+        std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+        FILE* file = fopen(path.c_str(), "r");
+        if (file == nullptr) {
+            if (node > 0) break;
+            continue;
+        }
+        std::vector<int> cpus;
+        int first, last;
+        while (fscanf(file, "%d", &first) == 1) {
+            last = first;
+            int c = fgetc(file);
+            if (c == '-') {
+                if (fscanf(file, "%d", &last) != 1) break;
+                c = fgetc(file);
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+            }
+            if (c != ',') break;
+        }
+        fclose(file);
+        if (!cpus.empty()) {
+            nodes.push_back(cpus);
+        }
+    }
+    if (nodes.empty()) {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        }
+        nodes.push_back(cpus);
+    }
+    return nodes;
+}
+
+// NUMBER OF NUMA NODES THE PROCESS CAN RUN ON
+int NumaNodes() {
+    return (int) NodeCpus().size();
+}
+
+// PIN THE OPENMP THREADS TO CPUS
+// Every thread of the team is bound to one cpu of the process' own mask (so it composes with
+// the binding of mpirun), in the order the policy gives. The team is reused by later parallel
+// regions of the same size, so the pinning holds as long as the thread count doesn't change.
+// Call it before the chain is allocated, the first touch then lands on the right nodes.
+// AFFINITY_NONE gives every thread the whole mask back. Nothing is done when OMP_PROC_BIND
+// already binds the threads.
+// PARAMS: (AffinityPolicy)
+// RETURNS: false if the threads were left where they were
+bool PinThreads(int policy) {
+#ifdef _OPENMP
+    if (omp_get_proc_bind() != omp_proc_bind_false) {
+        return false;
+    }
+    std::vector<std::vector<int>> nodes = NodeCpus();
+    std::vector<int> order;
+    if (policy == AFFINITY_COMPACT) {
+        for (const std::vector<int>& cpus : nodes) {
+            order.insert(order.end(), cpus.begin(), cpus.end());
+        }
+    }
+    else if (policy == AFFINITY_SPREAD) {
+        for (size_t k = 0; order.size() < (size_t) CPU_COUNT(&AllowedCpus()); k++) {
+            for (const std::vector<int>& cpus : nodes) {
+                if (k < cpus.size()) order.push_back(cpus[k]);
+            }
+        }
+    }
+    int failures = 0;
+    int threads = 1;
+    #pragma omp parallel reduction(+:failures)
+    {
+        cpu_set_t set;
+        if (order.empty()) {
+            set = AllowedCpus();
+        }
+        else {
+            CPU_ZERO(&set);
+            CPU_SET(order[omp_get_thread_num() % order.size()], &set);
+        }
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0) {
+            failures++;
+        }
+        #pragma omp single
+        threads = omp_get_num_threads();
+    }
+    if (failures > 0) {
+        printf("Couldn't pin %d of %d threads\n", failures, threads);
+        return false;
+    }
+    if (!order.empty()) {
+        printf("Pinned %d threads %s over %zu NUMA node(s)\n", threads,
+               (policy == AFFINITY_COMPACT) ? "compactly" : "spread", nodes.size());
+    }
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,325 @@
+#include "utils.h"
+#include "Simulation.h"
+#include "DataLogger.h"
+#include "SpinWaves.h"
+#include "AdaptiveStepper.h"
+#include <vector>
+#include <complex>
+#include <cstdio>
+#include <math.h>
+
+// PARAMETERS OF THE CHAIN WITH EVERY OTHER SITE
+// A site of the coarse chain stands for two of the fine one, so a spiral of pitch Q has the pitch
+// 2Q there (or 2 pi - 2Q, the same spiral turning the other way, when Q > pi / 2). Spirals keep J2
+// and get the J1 whose classical pitch is that, collinear states become ferromagnetic. The dipolar
+// coupling falls off as 1 / r^3 and the absorbers keep their physical width.
+// PARAMS: (pointer to the params of the fine chain)
+// RETURNS: the params of the coarse chain
+static Params CoarseParams(Params* fine) {
+    Params coarse = *fine;
+    coarse.n_of_particles = fine->n_of_particles / 2;
+    double Q = ClassicalPitch(fine->J1, fine->J2);
+    double q = (Q <= M_PI / 2) ? 2.0 * Q : 2.0 * M_PI - 2.0 * Q;
+    if (q > 1e-6 && fine->J2 > 0.0f) {
+        coarse.J1 = (float) (-4.0 * fine->J2 * cos(q));
+    }
+    else {
+        coarse.J1 = -fabsf(fine->J1);
+    }
+    coarse.dipolar_D = fine->dipolar_D / 8.0f;
+    coarse.sponge_width = (fine->sponge_width / 2 > 2) ? fine->sponge_width / 2 : 2;
+    coarse.thermal_on = false;
+    coarse.multigrid_levels = 0;
+    return coarse;
+}
+
+// INTERPOLATE A RELAXED COARSE CHAIN ONTO THE FINE ONE
+// Coarse site i becomes fine site 2i, and fine site 2i + 1 is the normalized midpoint of coarse
+// sites i and i + 1, turned around when the fine pitch is above pi / 2 (the coarse neighbours are
+// then closer the other way round the circle).
+// PARAMS: (the coarse sites), (pointer to the params of the fine chain)
+// RETURNS: the fine sites
+static FirstTouchVector<Particle> Prolong(const FirstTouchVector<Particle>& coarse, Params* fine) {
+    int N = fine->n_of_particles;
+    int n = (int) coarse.size();
+    float sign = (ClassicalPitch(fine->J1, fine->J2) > M_PI / 2) ? -1.0f : 1.0f;
+    float distance = 100.0f / N;
+    FirstTouchVector<Particle> result(N);
+	#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++) {
+        int j = i / 2;
+        Vector3 spin = coarse[j].spin;
+        if (i % 2 == 1) {
+            Vector3 next = (j + 1 < n) ? coarse[j + 1].spin : (fine->open_ends ? spin : coarse[0].spin);
+            Vector3 middle = Vector3Add(spin, next);
+            if (Vector3Length(middle) > 1e-3f) {
+                spin = Vector3Scale(Vector3Normalize(middle), sign);
+            }
+        }
+        result[i] = (Particle) { (Vector3) { (float) i * distance, 0, 0 }, spin };
+    }
+    return result;
+}
+
+// RELAX COARSER COPIES OF THE CHAIN FIRST (MULTIGRID)
+// The chain is thinned to every other site params->multigrid_levels times (while the number of
+// sites stays even and at least 32). The coarsest chain is relaxed from the thinned start, and
+// every relaxed level is interpolated onto the next finer one and relaxed again. Long-wavelength
+// defects anneal on the short chains, so the full chain is left with short-range errors only.
+// The levels share one budget in steps of the full chain, so the rest of it can go to
+// RelaxGroundState and the whole relaxation stays within the caller's limit.
+// PARAMS: (reference to a vector of the sites, replaced by the interpolated, not yet relaxed chain),
+//         (pointer to simulation params), (most steps of the full chain for all levels together)
+// RETURNS: the steps taken on the coarse levels, in steps of the full chain (a step of a level
+//          with half the sites counts half), never more than max_steps
+long CoarseToFine(FirstTouchVector<Particle>& particles, Params* params, long max_steps) {
+    std::vector<Params> levels(1, *params);
+    while ((int) levels.size() <= params->multigrid_levels && levels.back().n_of_particles % 2 == 0
+           && levels.back().n_of_particles / 2 >= 32) {
+        levels.push_back(CoarseParams(&levels.back()));
+    }
+    if (levels.size() == 1) {
+        return 0;
+    }
+
+    // thin the start down to the coarsest level
+    int coarsest = (int) levels.size() - 1;
+    int n = levels[coarsest].n_of_particles;
+    int step_between = params->n_of_particles / n;
+    float distance = 100.0f / n;
+    FirstTouchVector<Particle> chain(n);
+    for (int i = 0; i < n; i++) {
+        chain[i] = (Particle) { (Vector3) { (float) i * distance, 0, 0 }, particles[(size_t) i * step_between].spin };
+    }
+
+    double work = 0.0;
+    for (int level = coarsest; level >= 1; level--) {
+        double share = (double) levels[level].n_of_particles / params->n_of_particles;
+        long budget = (long) ((max_steps - work) / share);
+        long steps = RelaxGroundState(chain, &levels[level], (budget > 0) ? budget : 0, nullptr);
+        work += steps * share;
+        printf("Multigrid level %d: %d sites, J1 = %.3f, J2 = %.3f meV, relaxed in %ld steps\n", level,
+               levels[level].n_of_particles, levels[level].J1, levels[level].J2, steps);
+        chain = Prolong(chain, &levels[level - 1]);
+    }
+    particles = chain;
+    long total = (long) ceil(work);
+    return (total < max_steps) ? total : max_steps;
+}
+
+// STAGE 1: RELAX THE CHAIN UNTIL THE ENERGY STOPS CHANGING
+// Same criterion as the GUI, checked every 100 steps (of any length with adaptive_on). The
+// coarse levels of multigrid_levels are a separate step (CoarseToFine) before this one.
+// PARAMS: (reference to a vector of the sites), (pointer to simulation params), (most steps to take),
+//         (output: true if the energy stopped changing before max_steps, may be nullptr)
+// RETURNS: the number of steps taken
+long RelaxGroundState(FirstTouchVector<Particle>& particles, Params* params, long max_steps, bool* converged) {
+    float min_change = (params->n_of_particles / 100000.0f) * 5;
+    float previous_energy = getTotalEnergy(particles, params);
+    AdaptiveStepper stepper;
+    long step = 0;
+    bool settled = false;
+    while (step < max_steps && !settled) {
+        stepper.relax(particles, params);
+        step++;
+        if (step % 100 == 0) {
+            float energy = getTotalEnergy(particles, params);
+            // ten steps worth of energy change
+            float change = fabsf(energy - previous_energy) / 10.0f;
+            previous_energy = energy;
+            settled = change < min_change;
+        }
+    }
+    if (converged != nullptr) {
+        *converged = settled;
+    }
+    return step;
+}
+
+// STAGE 2: REMOVE THE DAMPING, FIRE THE PULSES AND RECORD
+// PARAMS: (reference to a vector of the relaxed sites), (pointer to simulation params)
+// RETURNS: the logger with the recording, ready for analyze (owned by the caller), nullptr if the
+// segments couldn't be planned
+DataLogger* RecordPulse(FirstTouchVector<Particle>& particles, Params* params) {
+    params->damping = 0.00001f;
+    params->dt_ps = 0.001f;
+
+    FirstTouchVector<Particle> ground_state = particles;
+    float recording_time = (2 * M_PI * params->hbar) / params->energy_resolution;
+    bool averaging = params->welch_segments > 1 || params->pulse_repeats > 1;
+    int stride = DataLogger::recording_stride(params);
+    int segment_snapshots = (int) (recording_time / (stride * params->dt_ps));
+    if (averaging) {
+        recording_time *= 1.0f + (params->welch_segments - 1) * (1.0f - params->welch_overlap);
+    }
+    size_t size_hint = (size_t) (recording_time / (stride * params->dt_ps)) * params->n_of_particles;
+
+    DataLogger* logger = new DataLogger(size_hint, ground_state);
+    logger->plan_recording(params);
+    if (averaging && !logger->plan_segments(segment_snapshots, params)) {
+        delete logger;
+        return nullptr;
+    }
+
+    // Linear spin waves of the relaxed state, analytic or on chains short enough to diagonalize
+    std::vector<SpinWaveMode> spin_waves;
+    if (LinearSpinWaves(ground_state, params, spin_waves)) {
+        logger->overlay(spin_waves);
+    }
+
+    AdaptiveStepper stepper;
+    for (int pulse = 0; pulse < params->pulse_repeats; pulse++) {
+        if (pulse > 0) {
+            ground_state = particles;
+            logger->next_block(ground_state);
+        }
+        float current_time = 0.0f;
+        params->ext_field_on = true;
+        while (current_time < params->ext_field_pulse_lenght) {
+            stepper.advance(particles, params);
+            current_time += params->dt_ps;
+        }
+        params->ext_field_on = false;
+
+        float rec_start_time = current_time + 20.0f;
+        float rec_end_time = rec_start_time + recording_time;
+        while (current_time < rec_end_time) {
+            stepper.advance(particles, params);
+            if (current_time >= rec_start_time) {
+                logger->record(particles.data(), params);
+            }
+            current_time += params->dt_ps;
+        }
+    }
+    return logger;
+}
+
+// REFLECTION OF THE ABSORBING LAYERS FOR ONE WAVE NUMBER
+// A small Gaussian wave packet exp(i k0 n) is put on the middle of the relaxed chain and left to run
+// into the layers at one end. In the local frame of every site (e1 out of the spiral plane, e2 in
+// it) the deviation of a travelling wave is c u + i v / c = exp(i(kn - wt)) one way and exp(i(-kn - wt))
+// the other, with c^4 the ratio of the out-of-plane and in-plane stiffness, so the part of the
+// spectrum of the interior with the opposite sign of k is what came back. It is compared with
+// the launched part when the reflection should be back in the middle of the chain. The unperturbed
+// chain is run alongside and subtracted, so a state that is not fully relaxed doesn't count as a wave.
+// PARAMS: (reference to the relaxed sites), (pointer to simulation params), (wave number), (output: hbar omega of the wave)
+// RETURNS: reflected amplitude over the launched amplitude, -1 if the state is not a uniform spiral,
+// the wave doesn't travel or the chain is too short
+float MeasureReflection(const FirstTouchVector<Particle>& ground_state, Params* params, float k0, float* energy) {
+    Params measure = *params;
+    measure.damping = 0.00001f;
+    measure.dt_ps = 0.001f;
+    measure.ext_field_on = false;
+    measure.thermal_on = false;
+    int N = measure.n_of_particles;
+    int width = measure.sponge_width;
+    int lo = width + 1;
+    int hi = N - width - 1;
+    int L = hi - lo;
+    if (L < 32) {
+        return -1.0f;
+    }
+
+    // the interior has to be a uniform spiral, the ends of an open chain may bend
+    FirstTouchVector<Particle> interior(ground_state.begin() + lo, ground_state.begin() + hi);
+    Params interior_params = measure;
+    interior_params.n_of_particles = L;
+    interior_params.open_ends = true;
+    float spread;
+    double Q = SpiralPitch(interior, &interior_params, &spread);
+    if (spread > 0.05f) {
+        printf("The state is not a uniform spiral (spread %f), relax it further before measuring reflections\n", spread);
+        return -1.0f;
+    }
+
+    // local frame of every site, e1 along the normal of the spiral (as close to z as possible when collinear)
+    Vector3 normal = (Vector3) {0, 0, 1};
+    Vector3 normal_sum = Vector3Zero();
+    for (int i = 0; i + 1 < N; i++) {
+        normal_sum = Vector3Add(normal_sum, Vector3CrossProduct(ground_state[i].spin, ground_state[i + 1].spin));
+    }
+    if (Vector3Length(normal_sum) > 1e-6f * N) {
+        normal = Vector3Normalize(normal_sum);
+    }
+    std::vector<Vector3> e1(N), e2(N);
+    for (int i = 0; i < N; i++) {
+        Vector3 e3 = ground_state[i].spin;
+        Vector3 axis = normal;
+        Vector3 a = Vector3Subtract(axis, Vector3Scale(e3, Vector3DotProduct(axis, e3)));
+        if (Vector3Length(a) < 1e-3f) {
+            axis = (Vector3) {1, 0, 0};
+            a = Vector3Subtract(axis, Vector3Scale(e3, Vector3DotProduct(axis, e3)));
+        }
+        e1[i] = Vector3Normalize(a);
+        e2[i] = Vector3CrossProduct(e3, e1[i]);
+    }
+
+    // ellipticity and group velocity (sites per ps) from the dispersion of the spiral
+    auto J = [&](double k) {
+        return 2.0 * measure.J1 * cos(k) + 2.0 * measure.J2 * cos(2.0 * k);
+    };
+    double out_of_plane = J(k0) - J(Q);
+    double in_plane = 0.5 * (J(k0 + Q) + J(k0 - Q)) - J(Q);
+    double dk = 1e-4;
+    *energy = (float) SpiralEnergy(k0, Q, &measure);
+    double velocity = fabs(SpiralEnergy(k0 + dk, Q, &measure) - SpiralEnergy(k0 - dk, Q, &measure)) / (2.0 * dk * measure.hbar);
+    if (velocity < 1e-3 || out_of_plane <= 0.0 || in_plane <= 0.0) {
+        return -1.0f;
+    }
+    double c = pow(out_of_plane / in_plane, 0.25);
+
+    // launch the packet
+    FirstTouchVector<Particle> reference = ground_state;
+    FirstTouchVector<Particle> particles = ground_state;
+    double sigma = L / 16.0;
+    double center = lo + L / 2.0;
+    float amplitude = 0.005f; // small, a spiral mixes stronger waves into both directions
+    for (int i = 0; i < N; i++) {
+        double envelope = amplitude * exp(-(i - center) * (i - center) / (2.0 * sigma * sigma));
+        Vector3 deviation = Vector3Add(Vector3Scale(e1[i], (float) (envelope * cos(k0 * i) / c)),
+                                       Vector3Scale(e2[i], (float) (envelope * sin(k0 * i) * c)));
+        particles[i].spin = Vector3Normalize(Vector3Add(ground_state[i].spin, deviation));
+    }
+
+    // power of the interior with the sign of k0 and with the opposite sign, Hann windowed. A slow
+    // rotation of the whole chain (the zero modes at k = 0 and k = Q) is not a wave, so the mean
+    // and the bins next to Q are left out.
+    auto power = [&](double* same, double* opposite) {
+        std::vector<std::complex<double>> psi(L);
+        std::complex<double> mean = 0.0;
+        for (int i = lo; i < hi; i++) {
+            Vector3 deviation = Vector3Subtract(particles[i].spin, reference[i].spin);
+            psi[i - lo] = std::complex<double>(c * Vector3DotProduct(deviation, e1[i]), Vector3DotProduct(deviation, e2[i]) / c);
+            mean += psi[i - lo] / (double) L;
+        }
+        *same = 0.0;
+        *opposite = 0.0;
+        for (int j = 3; j < L / 2; j++) {
+            double k = 2.0 * M_PI * j / L;
+            if (fabs(k - Q) < 3.0 * 2.0 * M_PI / L) {
+                continue;
+            }
+            std::complex<double> plus = 0.0, minus = 0.0;
+            for (int n = 0; n < L; n++) {
+                double window = 0.5 * (1.0 - cos(2.0 * M_PI * n / (L - 1)));
+                plus += window * (psi[n] - mean) * std::polar(1.0, -k * (n + lo));
+                minus += window * (psi[n] - mean) * std::polar(1.0, k * (n + lo));
+            }
+            *same += std::norm(plus);
+            *opposite += std::norm(minus);
+        }
+    };
+    double launched, unused;
+    power(&launched, &unused);
+
+    // out to the layer, through it and back to the middle
+    double time = (L + 2.0 * width) / velocity;
+    long steps = (long) (time / measure.dt_ps);
+    for (long step = 0; step < steps; step++) {
+        MinimizeEnergy(particles, &measure);
+        MinimizeEnergy(reference, &measure);
+    }
+    double remaining, reflected;
+    power(&remaining, &reflected);
+    return (float) sqrt(reflected / launched);
+}
@@ -0,0 +1,386 @@
+#include "SnapshotStore.h"
+#include <cstdio>
+#include <cstring>
+#include <math.h>
+
+// sites per independently coded block, and values per Rice parameter
+static const int BLOCK = 4096;
+static const int RICE_GROUP = 256;
+// quotients from here on are written as an escape and the raw 17-bit zigzag value
+static const int RICE_ESCAPE = 24;
+
+// HALF FLOAT CONVERSION (round to nearest even, no infinities or NaNs needed here)
+static uint16_t FloatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int) ((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent >= 31) {
+        return sign | 0x7bff; // largest half
+    }
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return sign;
+        }
+        // subnormal half
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) half++;
+        return sign | (uint16_t) half;
+    }
+    uint32_t half = ((uint32_t) exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+    if (half >= 0x7c00) half = 0x7bff;
+    return sign | (uint16_t) half;
+}
+
+static float HalfToFloat(uint16_t half) {
+    uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+    int exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        }
+        else {
+            // normalize the subnormal
+            exponent = 1;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            mantissa &= 0x3ff;
+            bits = sign | ((uint32_t) (exponent - 15 + 127) << 23) | (mantissa << 13);
+        }
+    }
+    else {
+        bits = sign | ((uint32_t) (exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+// half floats as integers in the order of their values, so neighbouring values have small differences
+static int32_t HalfToOrdered(uint16_t half) {
+    return (half & 0x8000) ? -(int32_t) (half & 0x7fff) : (int32_t) half;
+}
+
+static uint16_t OrderedToHalf(int32_t ordered) {
+    return (ordered < 0) ? (uint16_t) (0x8000 | -ordered) : (uint16_t) ordered;
+}
+
+// Bits are written and read from the least significant end
+struct BitWriter {
+    std::vector<uint8_t>& out;
+    uint64_t acc = 0;
+    int count = 0;
+    BitWriter(std::vector<uint8_t>& out) : out(out) {}
+    void put(uint32_t value, int bits) {
+        acc |= (uint64_t) value << count;
+        count += bits;
+        while (count >= 8) {
+            out.push_back((uint8_t) acc);
+            acc >>= 8;
+            count -= 8;
+        }
+    }
+    void flush() {
+        if (count > 0) {
+            out.push_back((uint8_t) acc);
+        }
+        acc = 0;
+        count = 0;
+    }
+};
+
+struct BitReader {
+    const uint8_t* data;
+    const uint8_t* end;
+    uint64_t acc = 0;
+    int count = 0;
+    BitReader(const uint8_t* data, const uint8_t* end) : data(data), end(end) {}
+    void refill() {
+        while (count <= 56) {
+            acc |= (uint64_t) (data < end ? *data : 0) << count;
+            data++;
+            count += 8;
+        }
+    }
+    uint32_t peek(int bits) {
+        return (uint32_t) (acc & ((1ull << bits) - 1));
+    }
+    void skip(int bits) {
+        acc >>= bits;
+        count -= bits;
+    }
+    uint32_t get(int bits) {
+        if (bits == 0) return 0;
+        refill();
+        uint32_t value = peek(bits);
+        skip(bits);
+        return value;
+    }
+};
+
+// RICE CODE ONE BLOCK OF 16-BIT SYMBOLS
+// Differences to the previous symbol are zigzag mapped and written with one Rice parameter
+// per group of RICE_GROUP, the one that fits their mean.
+static void EncodeBlock(const int32_t* symbols, int n, std::vector<uint8_t>& out) {
+    out.clear();
+    BitWriter writer(out);
+    int32_t previous = 0;
+    std::vector<uint32_t> zigzag(RICE_GROUP);
+    for (int g = 0; g < n; g += RICE_GROUP) {
+        int m = (n - g < RICE_GROUP) ? n - g : RICE_GROUP;
+        uint64_t sum = 0;
+        for (int i = 0; i < m; i++) {
+            int32_t delta = symbols[g + i] - previous;
+            previous = symbols[g + i];
+            zigzag[i] = (uint32_t) ((delta << 1) ^ (delta >> 31));
+            sum += zigzag[i];
+        }
+        int k = 0;
+        while (k < 16 && ((uint64_t) m << (k + 1)) <= sum) {
+            k++;
+        }
+        writer.put(k, 5);
+        for (int i = 0; i < m; i++) {
+            uint32_t q = zigzag[i] >> k;
+            if (q < RICE_ESCAPE) {
+                writer.put((1u << q) - 1, q + 1);
+                writer.put(zigzag[i] & ((1u << k) - 1), k);
+            }
+            else {
+                writer.put((1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+                writer.put(zigzag[i], 17);
+            }
+        }
+    }
+    writer.flush();
+}
+
+static void DecodeBlock(const uint8_t* data, const uint8_t* end, int n, int32_t* symbols) {
+    BitReader reader(data, end);
+    int32_t previous = 0;
+    for (int g = 0; g < n; g += RICE_GROUP) {
+        int m = (n - g < RICE_GROUP) ? n - g : RICE_GROUP;
+        int k = (int) reader.get(5);
+        for (int i = 0; i < m; i++) {
+            reader.refill();
+            uint32_t ones = reader.peek(RICE_ESCAPE);
+            int q = __builtin_ctz(~ones);
+            uint32_t zigzag;
+            if (q < RICE_ESCAPE) {
+                reader.skip(q + 1);
+                zigzag = ((uint32_t) q << k) | reader.get(k);
+            }
+            else {
+                reader.skip(RICE_ESCAPE);
+                zigzag = reader.get(17);
+            }
+            int32_t delta = (int32_t) (zigzag >> 1) ^ -(int32_t) (zigzag & 1);
+            previous += delta;
+            symbols[g + i] = previous;
+        }
+    }
+}
+
+// CHOOSE THE CODEC, BEFORE THE FIRST SNAPSHOT
+// A tolerance coarser than the finest int16 step of a snapshot makes the step 2 * tolerance, so
+// the integers and their differences are smaller and the Rice codes shorter.
+// PARAMS: (SnapshotCodec), (values per snapshot), (largest error of an int16 value, 0 = finest step)
+void SnapshotStore::configure(int codec, int values_per_snapshot, float tolerance) {
+    this->codec = codec;
+    N = values_per_snapshot;
+    this->tolerance = (tolerance > 0.0f) ? tolerance : 0.0f;
+    clear();
+}
+
+bool SnapshotStore::configured() const {
+    return N > 0;
+}
+
+bool SnapshotStore::compressed() const {
+    return codec != SNAPSHOT_FLOAT32;
+}
+
+void SnapshotStore::reserve(size_t n_of_values) {
+    if (codec == SNAPSHOT_FLOAT32) {
+        raw.reserve(n_of_values);
+    }
+}
+
+// ADD A SNAPSHOT
+// PARAMS: (N values)
+void SnapshotStore::push(const float* row) {
+    if (codec == SNAPSHOT_FLOAT32) {
+        raw.insert(raw.end(), row, row + N);
+        return;
+    }
+    encode(row);
+}
+
+// A snapshot is [scale (float)][n_blocks x uint32 bytes of each block][blocks]
+void SnapshotStore::encode(const float* row) {
+    float max_value = 0.0f;
+    for (int i = 0; i < N; i++) {
+        max_value = fmaxf(max_value, fabsf(row[i]));
+    }
+    float scale = (codec == SNAPSHOT_INT16) ? fmaxf(max_value / 32767.0f, 2.0f * tolerance) : max_value;
+    float inverse = (scale > 0.0f) ? 1.0f / scale : 0.0f;
+
+    int n_blocks = (N + BLOCK - 1) / BLOCK;
+    block_buffers.resize(n_blocks);
+    double error_sum = 0.0, signal_sum = 0.0;
+    float error_max = 0.0f;
+	#pragma omp parallel for reduction(+:error_sum, signal_sum) reduction(max:error_max)
+    for (int b = 0; b < n_blocks; b++) {
+        int first = b * BLOCK;
+        int n = (N - first < BLOCK) ? N - first : BLOCK;
+        int32_t symbols[BLOCK];
+        for (int i = 0; i < n; i++) {
+            float x = row[first + i];
+            float decoded;
+            if (codec == SNAPSHOT_INT16) {
+                symbols[i] = (int32_t) lrintf(x * inverse);
+                decoded = symbols[i] * scale;
+            }
+            else {
+                uint16_t half = FloatToHalf(x * inverse);
+                symbols[i] = HalfToOrdered(half);
+                decoded = HalfToFloat(half) * scale;
+            }
+            float error = fabsf(decoded - x);
+            error_sum += (double) error * error;
+            signal_sum += (double) x * x;
+            error_max = fmaxf(error_max, error);
+        }
+        EncodeBlock(symbols, n, block_buffers[b]);
+    }
+    error_sq += error_sum;
+    signal_sq += signal_sum;
+    max_error = fmaxf(max_error, error_max);
+    values += N;
+
+    frame_start.push_back(bytes.size());
+    const uint8_t* scale_bytes = (const uint8_t*) &scale;
+    bytes.insert(bytes.end(), scale_bytes, scale_bytes + sizeof(float));
+    for (int b = 0; b < n_blocks; b++) {
+        uint32_t length = (uint32_t) block_buffers[b].size();
+        const uint8_t* length_bytes = (const uint8_t*) &length;
+        bytes.insert(bytes.end(), length_bytes, length_bytes + sizeof(uint32_t));
+    }
+    for (int b = 0; b < n_blocks; b++) {
+        bytes.insert(bytes.end(), block_buffers[b].begin(), block_buffers[b].end());
+    }
+}
+
+// DECODE ONE SNAPSHOT
+// PARAMS: (SnapshotCodec), (values per snapshot), (the coded snapshot), (its bytes), (output: N values)
+void SnapshotStore::decode_frame(int codec, int N, const uint8_t* data, size_t length, float* row) {
+    const uint8_t* end = data + length;
+    float scale;
+    memcpy(&scale, data, sizeof(float));
+    int n_blocks = (N + BLOCK - 1) / BLOCK;
+    std::vector<size_t> offsets(n_blocks + 1);
+    offsets[0] = sizeof(float) + n_blocks * sizeof(uint32_t);
+    for (int b = 0; b < n_blocks; b++) {
+        uint32_t block_bytes;
+        memcpy(&block_bytes, data + sizeof(float) + b * sizeof(uint32_t), sizeof(uint32_t));
+        offsets[b + 1] = offsets[b] + block_bytes;
+    }
+    for (int b = 0; b < n_blocks; b++) {
+        int first = b * BLOCK;
+        int n = (N - first < BLOCK) ? N - first : BLOCK;
+        int32_t symbols[BLOCK];
+        const uint8_t* block_end = (data + offsets[b + 1] < end) ? data + offsets[b + 1] : end;
+        DecodeBlock(data + offsets[b], block_end, n, symbols);
+        for (int i = 0; i < n; i++) {
+            row[first + i] = (codec == SNAPSHOT_INT16) ? symbols[i] * scale
+                                                       : HalfToFloat(OrderedToHalf(symbols[i])) * scale;
+        }
+    }
+}
+
+// NUMBER OF SNAPSHOTS HELD
+long SnapshotStore::size() const {
+    if (N == 0) {
+        return 0;
+    }
+    return (codec == SNAPSHOT_FLOAT32) ? (long) (raw.size() / N) : (long) frame_start.size();
+}
+
+// READ ONE SNAPSHOT
+// PARAMS: (index of the snapshot), (output: N values)
+void SnapshotStore::read(long t, float* row) const {
+    if (codec == SNAPSHOT_FLOAT32) {
+        memcpy(row, &raw[(size_t) t * N], (size_t) N * sizeof(float));
+        return;
+    }
+    decode_frame(codec, N, &bytes[frame_start[t]], frame_offset(t + 1) - frame_start[t], row);
+}
+
+// READ CONSECUTIVE SNAPSHOTS, DECODED IN PARALLEL
+// PARAMS: (first snapshot), (number of snapshots), (output: count * N values)
+void SnapshotStore::read_block(long first, long count, float* rows) const {
+	#pragma omp parallel for
+    for (long t = 0; t < count; t++) {
+        read(first + t, rows + (size_t) t * N);
+    }
+}
+
+// FORGET THE OLDEST SNAPSHOTS
+void SnapshotStore::drop_front(long count) {
+    if (count <= 0) {
+        return;
+    }
+    if (codec == SNAPSHOT_FLOAT32) {
+        raw.erase(raw.begin(), raw.begin() + (size_t) count * N);
+        return;
+    }
+    size_t cut = ((size_t) count < frame_start.size()) ? frame_start[count] : bytes.size();
+    bytes.erase(bytes.begin(), bytes.begin() + cut);
+    frame_start.erase(frame_start.begin(), frame_start.begin() + ((size_t) count < frame_start.size() ? count : frame_start.size()));
+    for (size_t& offset : frame_start) {
+        offset -= cut;
+    }
+}
+
+void SnapshotStore::clear() {
+    raw.clear();
+    bytes.clear();
+    frame_start.clear();
+}
+
+// THE CODED SNAPSHOTS BACK TO BACK, SNAPSHOT t STARTS AT frame_offset(t)
+const std::vector<uint8_t>& SnapshotStore::encoded() const {
+    return bytes;
+}
+
+// PARAMS: (index of the snapshot, size() for the end of the last one)
+size_t SnapshotStore::frame_offset(long t) const {
+    return ((size_t) t < frame_start.size()) ? frame_start[t] : bytes.size();
+}
+
+// BYTES HELD BY THE SNAPSHOTS
+size_t SnapshotStore::memory() const {
+    return raw.size() * sizeof(float) + bytes.size() + frame_start.size() * sizeof(size_t);
+}
+
+// PRINT THE COMPRESSION RATIO AND THE QUANTIZATION ERROR
+void SnapshotStore::report() const {
+    if (codec == SNAPSHOT_FLOAT32 || values == 0) {
+        return;
+    }
+    double stored = (double) size() * N * sizeof(float);
+    printf("Snapshots compressed %.1fx (%s), quantization error max %.3e, rms %.3e (%.4f%% of the signal rms)\n",
+           (memory() > 0) ? stored / memory() : 0.0, (codec == SNAPSHOT_INT16) ? "int16" : "float16",
+           max_error, sqrt(error_sq / values), (signal_sq > 0.0) ? 100.0 * sqrt(error_sq / signal_sq) : 0.0);
+}
@@ -0,0 +1,208 @@
+#include "SpectralZoom.h"
+#include <complex>
+#include <math.h>
+
+typedef std::complex<double> Complex;
+
+// smallest length >= n with no prime factor above 7, which FFTW transforms fastest
+static int SmoothLength(int n) {
+    for (int length = n; ; length++) {
+        int rest = length;
+        for (int p : {2, 3, 5, 7}) {
+            while (rest % p == 0) rest /= p;
+        }
+        if (rest == 1) return length;
+    }
+}
+
+// exp(-i phase) for phases of up to ~1e10 radians, reduced in double first
+static Complex Chirp(double phase) {
+    phase = fmod(phase, 2.0 * M_PI);
+    return Complex(cos(phase), -sin(phase));
+}
+
+ChirpZ::~ChirpZ() {
+    release();
+}
+
+void ChirpZ::release() {
+    if (forward) fftwf_destroy_plan(forward);
+    if (backward) fftwf_destroy_plan(backward);
+    fftwf_free(kernel);
+    forward = nullptr;
+    backward = nullptr;
+    kernel = nullptr;
+}
+
+// PREPARE THE TRANSFORM OF n_in SAMPLES TO n_out ANGLES
+// With mn = (m^2 + n^2 - (m - n)^2) / 2 the sum becomes
+// X_m = exp(-i dtheta m^2 / 2) sum_n [x_n exp(-i (theta0 n + dtheta n^2 / 2))] exp(i dtheta (m - n)^2 / 2),
+// a convolution that is done with FFTs. The plans are for new-array execution, so execute can be
+// called from several threads at once with their own buffers.
+// PARAMS: (samples in), (angles out), (first angle), (spacing of the angles), both in radians per sample
+// RETURNS: false if the transform couldn't be planned
+bool ChirpZ::plan(int n_in, int n_out, double theta0, double dtheta) {
+    release();
+    this->n_in = n_in;
+    this->n_out = n_out;
+    L = SmoothLength(n_in + n_out - 1);
+
+    pre.resize(2 * n_in);
+    for (int n = 0; n < n_in; n++) {
+        Complex c = Chirp(theta0 * n + 0.5 * dtheta * (double) n * n);
+        pre[2 * n] = c.real();
+        pre[2 * n + 1] = c.imag();
+    }
+    post.resize(2 * n_out);
+    for (int m = 0; m < n_out; m++) {
+        Complex c = Chirp(0.5 * dtheta * (double) m * m);
+        post[2 * m] = c.real();
+        post[2 * m + 1] = c.imag();
+    }
+
+    kernel = fftwf_alloc_complex(L);
+    fftwf_complex* buffer = fftwf_alloc_complex(L);
+    if (kernel == nullptr || buffer == nullptr) {
+        fftwf_free(buffer);
+        release();
+        return false;
+    }
+    forward = fftwf_plan_dft_1d(L, buffer, kernel, FFTW_FORWARD, FFTW_ESTIMATE);
+    backward = fftwf_plan_dft_1d(L, kernel, buffer, FFTW_BACKWARD, FFTW_ESTIMATE);
+    if (forward == nullptr || backward == nullptr) {
+        fftwf_free(buffer);
+        release();
+        return false;
+    }
+
+    // the chirp exp(i dtheta j^2 / 2) for j = -(n_in - 1) ... n_out - 1, wrapped around L
+    for (int j = 0; j < L; j++) {
+        buffer[j][0] = 0.0f;
+        buffer[j][1] = 0.0f;
+    }
+    for (int j = -(n_in - 1); j < n_out; j++) {
+        Complex c = std::conj(Chirp(0.5 * dtheta * (double) j * j));
+        int index = (j < 0) ? j + L : j;
+        buffer[index][0] = (float) c.real();
+        buffer[index][1] = (float) c.imag();
+    }
+    fftwf_execute_dft(forward, buffer, kernel);
+    for (int j = 0; j < L; j++) {
+        kernel[j][0] /= L;
+        kernel[j][1] /= L;
+    }
+    fftwf_free(buffer);
+    return true;
+}
+
+// offset of the spectrum in the work buffer, in complex values: new-array execution needs the
+// alignment of the fftwf_alloc_complex arrays the plans were made on, so it is a multiple of 64 bytes
+static int SpectrumOffset(int L) {
+    return (L + 7) & ~7;
+}
+
+// RETURNS: complex values the work buffer of execute needs
+int ChirpZ::work_size() const {
+    return SpectrumOffset(L) + L;
+}
+
+// EVALUATE THE DTFT OF ONE SERIES
+// PARAMS: (n_in samples), (output: n_out values), (work_size() values from fftwf_alloc_complex)
+void ChirpZ::execute(const fftwf_complex* x, fftwf_complex* X, fftwf_complex* work) const {
+    fftwf_complex* y = work;
+    fftwf_complex* spectrum = work + SpectrumOffset(L);
+    for (int n = 0; n < n_in; n++) {
+        Complex value = Complex(x[n][0], x[n][1]) * Complex(pre[2 * n], pre[2 * n + 1]);
+        y[n][0] = (float) value.real();
+        y[n][1] = (float) value.imag();
+    }
+    for (int n = n_in; n < L; n++) {
+        y[n][0] = 0.0f;
+        y[n][1] = 0.0f;
+    }
+    fftwf_execute_dft(forward, y, spectrum);
+    for (int j = 0; j < L; j++) {
+        float re = spectrum[j][0] * kernel[j][0] - spectrum[j][1] * kernel[j][1];
+        float im = spectrum[j][0] * kernel[j][1] + spectrum[j][1] * kernel[j][0];
+        spectrum[j][0] = re;
+        spectrum[j][1] = im;
+    }
+    fftwf_execute_dft(backward, spectrum, y);
+    for (int m = 0; m < n_out; m++) {
+        Complex value = Complex(y[m][0], y[m][1]) * Complex(post[2 * m], post[2 * m + 1]);
+        X[m][0] = (float) value.real();
+        X[m][1] = (float) value.imag();
+    }
+}
+
+// AUTOREGRESSIVE MODEL OF A COMPLEX SERIES WITH BURG'S METHOD
+// Fits x_n = -sum_{j=1..order} a_j x_{n-j} + e_n by minimizing the forward and backward prediction
+// errors together. The model spectrum noise / |sum_j a_j exp(-i theta j)|^2 separates peaks
+// closer than the 2 pi / n of a transform, which is what makes short recordings usable.
+// PARAMS: (series), (its length), (order of the model), (output: a_0 = 1 ... a_order, re/im interleaved),
+//         (output: variance of the prediction error)
+// RETURNS: false if the series is too short for the order or has no power
+bool BurgAR(const fftwf_complex* x, int n, int order, std::vector<double>& a, double* noise) {
+    if (order < 1 || n <= 2 * order) {
+        return false;
+    }
+    std::vector<Complex> forward_error(n), backward_error(n);
+    double power = 0.0;
+    for (int i = 0; i < n; i++) {
+        forward_error[i] = backward_error[i] = Complex(x[i][0], x[i][1]);
+        power += std::norm(forward_error[i]);
+    }
+    if (power <= 0.0) {
+        return false;
+    }
+    std::vector<Complex> coefficients(1, Complex(1.0, 0.0)), previous;
+    double error = power / n;
+    for (int m = 1; m <= order; m++) {
+        // reflection coefficient from the errors that overlap at this order
+        Complex numerator = 0.0;
+        double denominator = 0.0;
+        for (int i = m; i < n; i++) {
+            numerator += forward_error[i] * std::conj(backward_error[i - 1]);
+            denominator += std::norm(forward_error[i]) + std::norm(backward_error[i - 1]);
+        }
+        if (denominator <= 0.0) {
+            break;
+        }
+        Complex k = -2.0 * numerator / denominator;
+        for (int i = n - 1; i >= m; i--) {
+            Complex f = forward_error[i];
+            forward_error[i] = f + k * backward_error[i - 1];
+            backward_error[i] = backward_error[i - 1] + std::conj(k) * f;
+        }
+        // Levinson update of the coefficients
+        previous = coefficients;
+        coefficients.push_back(0.0);
+        for (int j = 1; j <= m; j++) {
+            Complex kept = (j < m) ? previous[j] : Complex(0.0);
+            coefficients[j] = kept + k * std::conj(previous[m - j]);
+        }
+        error *= 1.0 - std::norm(k);
+    }
+    a.resize(2 * coefficients.size());
+    for (size_t j = 0; j < coefficients.size(); j++) {
+        a[2 * j] = coefficients[j].real();
+        a[2 * j + 1] = coefficients[j].imag();
+    }
+    *noise = error;
+    return true;
+}
+
+// POWER OF AN AUTOREGRESSIVE MODEL AT ONE ANGLE
+// PARAMS: (coefficients from BurgAR), (prediction error variance), (radians per sample)
+// RETURNS: noise / |A(theta)|^2, the power per sample of a unit-length DTFT
+double ARPower(const std::vector<double>& a, double noise, double theta) {
+    Complex sum = 0.0;
+    Complex step = Complex(cos(theta), -sin(theta));
+    Complex phase = 1.0;
+    for (size_t j = 0; j < a.size() / 2; j++) {
+        sum += Complex(a[2 * j], a[2 * j + 1]) * phase;
+        phase *= step;
+    }
+    double denominator = std::norm(sum);
+    return (denominator > 0.0) ? noise / denominator : 0.0;
+}
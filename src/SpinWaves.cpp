@@ -0,0 +1,538 @@
+#include "utils.h"
+#include "SpinWaves.h"
+#include "DipolarField.h"
+#include <vector>
+#include <cstdio>
+#include <math.h>
+
+// Linear spin-wave theory of the relaxed chain. For a uniform planar spiral of
+// J1/J2 exchange the dispersion is analytic. Any other relaxed state (fields, dipolar
+// coupling, defects) is expanded to second order in the transverse deviations of each
+// spin around its own direction, which for unit spins is the Holstein-Primakoff
+// Hamiltonian, and the normal modes are found by diagonalization.
+
+// ESTIMATE THE PITCH OF A PLANAR SPIRAL
+// PARAMS: (relaxed spins), (pointer to simulation params), (output: how far the state is from a uniform planar spiral)
+// RETURNS: the turn angle Q between neighbouring spins (0..pi)
+float SpiralPitch(const FirstTouchVector<Particle>& ground_state, Params* params, float* spread) {
+    int N = params->n_of_particles;
+
+    // Normal of the spiral plane
+    Vector3 normal = Vector3Zero();
+    double dot_sum = 0.0;
+    // an open chain has no bond between its ends
+    int bonds = params->open_ends ? N - 1 : N;
+    for (int i = 0; i < bonds; i++) {
+        Vector3 S = ground_state[i].spin;
+        Vector3 next = ground_state[(i + 1) % N].spin;
+        normal = Vector3Add(normal, Vector3CrossProduct(S, next));
+        dot_sum += Vector3DotProduct(S, next);
+    }
+    if (Vector3Length(normal) < 1e-6f * N) {
+        // collinear state, ferro- or antiferromagnetic
+        *spread = 0.0f;
+        return (dot_sum >= 0.0) ? 0.0f : M_PI;
+    }
+    normal = Vector3Normalize(normal);
+
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    float out_of_plane = 0.0f;
+    for (int i = 0; i < bonds; i++) {
+        Vector3 S = ground_state[i].spin;
+        Vector3 next = ground_state[(i + 1) % N].spin;
+        double theta = atan2(Vector3DotProduct(normal, Vector3CrossProduct(S, next)), Vector3DotProduct(S, next));
+        sum += theta;
+        sum_sq += theta * theta;
+        out_of_plane = fmaxf(out_of_plane, fabsf(Vector3DotProduct(S, normal)));
+    }
+    double mean = sum / bonds;
+    double deviation = sqrt(fmax(sum_sq / bonds - mean * mean, 0.0));
+    *spread = fmaxf((float) deviation, out_of_plane);
+    return (float) fabs(mean);
+}
+
+// PITCH OF THE CLASSICAL GROUND STATE, THE Q THAT MINIMIZES J1 cos Q + J2 cos 2Q
+// cos Q = -J1 / (4 J2) inside the spiral phase, otherwise ferro- (0) or antiferromagnetic (pi)
+// PARAMS: (nearest neighbour coupling), (next-nearest neighbour coupling)
+double ClassicalPitch(float J1, float J2) {
+    if (J2 > 0.0f && fabsf(J1) < 4.0f * J2) {
+        return acos(-J1 / (4.0 * J2));
+    }
+    return (J1 < 0.0f) ? 0.0 : M_PI;
+}
+
+// ENERGY OF A SPIN WAVE ON A PLANAR SPIRAL WITH PITCH Q
+// hbar omega = sqrt( (J(k) - J(Q)) ((J(k + Q) + J(k - Q)) / 2 - J(Q)) ), J(k) = 2 J1 cos k + 2 J2 cos 2k
+// PARAMS: (wave number), (pitch of the spiral), (pointer to simulation params)
+// RETURNS: hbar omega (meV)
+double SpiralEnergy(double k, double Q, Params* params) {
+    auto J = [&](double k) {
+        return 2.0 * params->J1 * cos(k) + 2.0 * params->J2 * cos(2.0 * k);
+    };
+    double out_of_plane = J(k) - J(Q);
+    double in_plane = 0.5 * (J(k + Q) + J(k - Q)) - J(Q);
+    return sqrt(fmax(out_of_plane * in_plane, 0.0));
+}
+
+// DISPERSION OF A PLANAR SPIRAL WITH PITCH Q
+// PARAMS: (pitch of the spiral), (pointer to simulation params)
+// RETURNS: one mode for every k of the recorded spectrum
+std::vector<SpinWaveMode> AnalyticSpinWaves(float Q, Params* params) {
+    int N = params->n_of_particles;
+    std::vector<SpinWaveMode> modes;
+    for (int j = 0; j <= N / 2; j++) {
+        double k = 2.0 * M_PI * j / N;
+        modes.push_back((SpinWaveMode) { (float) k, (float) SpiralEnergy(k, Q, params), 1.0f });
+    }
+    return modes;
+}
+
+// EIGENVALUES AND EIGENVECTORS OF A SYMMETRIC MATRIX
+// Householder reduction to tridiagonal form followed by the implicit QL algorithm.
+// PARAMS: (size), (row-major matrix, overwritten by the eigenvectors as columns), (output eigenvalues, ascending)
+static void SymmetricEigen(int n, std::vector<double>& V, std::vector<double>& d) {
+    std::vector<double> e(n);
+    d.resize(n);
+    auto v = [&](int i, int j) -> double& { return V[(size_t) i * n + j]; };
+
+    for (int j = 0; j < n; j++) {
+        d[j] = v(n - 1, j);
+    }
+
+    // Householder reduction
+    for (int i = n - 1; i > 0; i--) {
+        double scale = 0.0;
+        double h = 0.0;
+        for (int k = 0; k < i; k++) {
+            scale += fabs(d[k]);
+        }
+        if (scale == 0.0) {
+            e[i] = d[i - 1];
+            for (int j = 0; j < i; j++) {
+                d[j] = v(i - 1, j);
+                v(i, j) = 0.0;
+                v(j, i) = 0.0;
+            }
+        }
+        else {
+            for (int k = 0; k < i; k++) {
+                d[k] /= scale;
+                h += d[k] * d[k];
+            }
+            double f = d[i - 1];
+            double g = sqrt(h);
+            if (f > 0) {
+                g = -g;
+            }
+            e[i] = scale * g;
+            h = h - f * g;
+            d[i - 1] = f - g;
+            for (int j = 0; j < i; j++) {
+                e[j] = 0.0;
+            }
+            for (int j = 0; j < i; j++) {
+                f = d[j];
+                v(j, i) = f;
+                g = e[j] + v(j, j) * f;
+                for (int k = j + 1; k <= i - 1; k++) {
+                    g += v(k, j) * d[k];
+                    e[k] += v(k, j) * f;
+                }
+                e[j] = g;
+            }
+            f = 0.0;
+            for (int j = 0; j < i; j++) {
+                e[j] /= h;
+                f += e[j] * d[j];
+            }
+            double hh = f / (h + h);
+            for (int j = 0; j < i; j++) {
+                e[j] -= hh * d[j];
+            }
+            for (int j = 0; j < i; j++) {
+                f = d[j];
+                g = e[j];
+                for (int k = j; k <= i - 1; k++) {
+                    v(k, j) -= (f * e[k] + g * d[k]);
+                }
+                d[j] = v(i - 1, j);
+                v(i, j) = 0.0;
+            }
+        }
+        d[i] = h;
+    }
+
+    // Accumulate transformations
+    for (int i = 0; i < n - 1; i++) {
+        v(n - 1, i) = v(i, i);
+        v(i, i) = 1.0;
+        double h = d[i + 1];
+        if (h != 0.0) {
+            for (int k = 0; k <= i; k++) {
+                d[k] = v(k, i + 1) / h;
+            }
+            for (int j = 0; j <= i; j++) {
+                double g = 0.0;
+                for (int k = 0; k <= i; k++) {
+                    g += v(k, i + 1) * v(k, j);
+                }
+                for (int k = 0; k <= i; k++) {
+                    v(k, j) -= g * d[k];
+                }
+            }
+        }
+        for (int k = 0; k <= i; k++) {
+            v(k, i + 1) = 0.0;
+        }
+    }
+    for (int j = 0; j < n; j++) {
+        d[j] = v(n - 1, j);
+        v(n - 1, j) = 0.0;
+    }
+    v(n - 1, n - 1) = 1.0;
+    e[0] = 0.0;
+
+    // Implicit QL iterations
+    for (int i = 1; i < n; i++) {
+        e[i - 1] = e[i];
+    }
+    e[n - 1] = 0.0;
+
+    double f = 0.0;
+    double tst1 = 0.0;
+    double eps = pow(2.0, -52.0);
+    for (int l = 0; l < n; l++) {
+        tst1 = fmax(tst1, fabs(d[l]) + fabs(e[l]));
+        int m = l;
+        while (m < n) {
+            if (fabs(e[m]) <= eps * tst1) {
+                break;
+            }
+            m++;
+        }
+        if (m == n) {
+            m = n - 1;
+        }
+
+        if (m > l) {
+            do {
+                double g = d[l];
+                double p = (d[l + 1] - g) / (2.0 * e[l]);
+                double r = hypot(p, 1.0);
+                if (p < 0) {
+                    r = -r;
+                }
+                d[l] = e[l] / (p + r);
+                d[l + 1] = e[l] * (p + r);
+                double dl1 = d[l + 1];
+                double h = g - d[l];
+                for (int i = l + 2; i < n; i++) {
+                    d[i] -= h;
+                }
+                f = f + h;
+
+                p = d[m];
+                double c = 1.0;
+                double c2 = c;
+                double c3 = c;
+                double el1 = e[l + 1];
+                double s = 0.0;
+                double s2 = 0.0;
+                for (int i = m - 1; i >= l; i--) {
+                    c3 = c2;
+                    c2 = c;
+                    s2 = s;
+                    g = c * e[i];
+                    h = c * p;
+                    r = hypot(p, e[i]);
+                    e[i + 1] = s * r;
+                    s = e[i] / r;
+                    c = p / r;
+                    p = c * d[i] - s * g;
+                    d[i + 1] = h + s * (c * g + s * d[i]);
+                    for (int k = 0; k < n; k++) {
+                        h = v(k, i + 1);
+                        v(k, i + 1) = s * v(k, i) + c * h;
+                        v(k, i) = c * v(k, i) - s * h;
+                    }
+                }
+                p = -s * s2 * c3 * el1 * e[l] / dl1;
+                e[l] = s * p;
+                d[l] = c * p;
+            } while (fabs(e[l]) > eps * tst1);
+        }
+        d[l] = d[l] + f;
+        e[l] = 0.0;
+    }
+
+    // Sort eigenvalues and vectors in ascending order
+    for (int i = 0; i < n - 1; i++) {
+        int k = i;
+        double p = d[i];
+        for (int j = i + 1; j < n; j++) {
+            if (d[j] < p) {
+                k = j;
+                p = d[j];
+            }
+        }
+        if (k != i) {
+            d[k] = d[i];
+            d[i] = p;
+            for (int j = 0; j < n; j++) {
+                p = v(j, i);
+                v(j, i) = v(j, k);
+                v(j, k) = p;
+            }
+        }
+    }
+}
+
+// NORMAL MODES OF THE SECOND ORDER EXPANSION AROUND A RELAXED STATE
+// Each spin is written S_i = e3_i sqrt(1 - x_i^2 - y_i^2) + x_i e1_i + y_i e2_i in its own frame,
+// which makes (x, y) canonical pairs. The energy to second order is z^T K z / 2 and the
+// frequencies are the symplectic eigenvalues of K, the square roots of the eigenvalues
+// of A^T A with K = L L and A = L J L.
+// PARAMS: (relaxed spins), (pointer to simulation params), (output modes)
+// RETURNS: false if the state isn't a stable minimum or has more than MAX_DIAGONALIZED_SITES sites
+bool HolsteinPrimakoffSpinWaves(const FirstTouchVector<Particle>& ground_state, Params* params, std::vector<SpinWaveMode>& modes) {
+    int N = params->n_of_particles;
+    int m = 2 * N;
+    if (N > MAX_DIAGONALIZED_SITES) {
+        printf("%d sites are too many to diagonalize (at most %d), no linear spin waves\n", N, MAX_DIAGONALIZED_SITES);
+        return false;
+    }
+    printf("Diagonalizing the Holstein-Primakoff Hamiltonian of %d sites...\n", N);
+
+    // Local frames, e1 as close to z as possible so S_z is carried by x
+    std::vector<Vector3> e1(N), e2(N), e3(N);
+    for (int i = 0; i < N; i++) {
+        e3[i] = Vector3Normalize(ground_state[i].spin);
+        Vector3 ref = (fabsf(e3[i].z) < 0.9f) ? (Vector3) {0.0f, 0.0f, 1.0f} : (Vector3) {1.0f, 0.0f, 0.0f};
+        e1[i] = Vector3Normalize(Vector3Subtract(ref, Vector3Scale(e3[i], Vector3DotProduct(ref, e3[i]))));
+        e2[i] = Vector3CrossProduct(e3[i], e1[i]);
+    }
+
+    // Local fields of the relaxed state
+    FirstTouchVector<Vector3> dipolar(N, Vector3Zero());
+    DipolarField dipolar_field;
+    if (params->dipolar_on) {
+        dipolar_field.compute(ground_state, params, dipolar);
+    }
+
+    std::vector<double> K((size_t) m * m, 0.0);
+    auto k_at = [&](int a, int b) -> double& { return K[(size_t) a * m + b]; };
+    auto couple = [&](int i, int j, auto&& tensor) {
+        Vector3* frame_i[2] = { &e1[i], &e2[i] };
+        Vector3* frame_j[2] = { &e1[j], &e2[j] };
+        for (int a = 0; a < 2; a++) {
+            for (int b = 0; b < 2; b++) {
+                k_at(a * N + i, b * N + j) += tensor(*frame_i[a], *frame_j[b]);
+            }
+        }
+    };
+
+    for (int i = 0; i < N; i++) {
+        Vector3 H = Vector3Add(CalculateH_eff(i, ground_state, params), dipolar[i]);
+        double h = Vector3DotProduct(H, e3[i]);
+        k_at(i, i) += h;
+        k_at(N + i, N + i) += h;
+
+        // exchange bonds to the right, counted from both ends
+        int neighbours[2] = { (i + 1) % N, (i + 2) % N };
+        float couplings[2] = { params->J1, params->J2 };
+        for (int n = 0; n < 2; n++) {
+            if (params->open_ends && i + n + 1 >= N) {
+                continue;
+            }
+            float J = couplings[n];
+            auto exchange = [&](Vector3 a, Vector3 b) { return J * Vector3DotProduct(a, b); };
+            couple(i, neighbours[n], exchange);
+            couple(neighbours[n], i, exchange);
+        }
+
+        if (params->dipolar_on) {
+            for (int j = 0; j < N; j++) {
+                if (j == i) {
+                    continue;
+                }
+                float r3 = 1.0f / powf(fabsf((float) (i - j)), 3);
+                auto dipole = [&](Vector3 a, Vector3 b) {
+                    return -params->dipolar_D * r3 * (2.0f * a.x * b.x - a.y * b.y - a.z * b.z);
+                };
+                couple(i, j, dipole);
+            }
+        }
+    }
+
+    // Symmetric square root K = L L, L = U sqrt(lambda) U^T. The zero-energy rotation modes
+    // make K singular and single precision spins leave rounding of either sign around
+    // them, so only clearly negative curvature counts as an unstable state.
+    std::vector<double> U = K;
+    std::vector<double> lambda;
+    SymmetricEigen(m, U, lambda);
+    double max_lambda = fmax(fabs(lambda[0]), fabs(lambda[m - 1]));
+    if (lambda[0] < -1e-4 * max_lambda) {
+        printf("The state is not a stable minimum, relax it further before computing spin waves\n");
+        return false;
+    }
+    std::vector<double> root(m);
+    for (int c = 0; c < m; c++) {
+        root[c] = sqrt(fmax(lambda[c], 0.0));
+    }
+    std::vector<double> L((size_t) m * m, 0.0);
+    auto l_at = [&](int a, int b) -> double& { return L[(size_t) a * m + b]; };
+	#pragma omp parallel for
+    for (int a = 0; a < m; a++) {
+        for (int b = 0; b <= a; b++) {
+            double sum = 0.0;
+            for (int c = 0; c < m; c++) {
+                sum += U[(size_t) a * m + c] * root[c] * U[(size_t) b * m + c];
+            }
+            L[(size_t) a * m + b] = sum;
+            L[(size_t) b * m + a] = sum;
+        }
+    }
+
+    // A = L J L with J (x, y) = (y, -x)
+    std::vector<double> A((size_t) m * m, 0.0);
+	#pragma omp parallel for
+    for (int a = 0; a < m; a++) {
+        for (int b = 0; b < m; b++) {
+            double sum = 0.0;
+            for (int c = 0; c < N; c++) {
+                sum += l_at(c, a) * l_at(N + c, b) - l_at(N + c, a) * l_at(c, b);
+            }
+            A[(size_t) a * m + b] = sum;
+        }
+    }
+    std::vector<double> V((size_t) m * m, 0.0);
+	#pragma omp parallel for
+    for (int a = 0; a < m; a++) {
+        for (int b = 0; b <= a; b++) {
+            double sum = 0.0;
+            for (int c = 0; c < m; c++) {
+                sum += A[(size_t) c * m + a] * A[(size_t) c * m + b];
+            }
+            V[(size_t) a * m + b] = sum;
+            V[(size_t) b * m + a] = sum;
+        }
+    }
+    std::vector<double> omega_sq;
+    SymmetricEigen(m, V, omega_sq);
+
+    // Label every mode with the k where its S_z signal peaks
+    std::vector<double> cos_table(N), sin_table(N);
+    for (int i = 0; i < N; i++) {
+        cos_table[i] = cos(2.0 * M_PI * i / N);
+        sin_table[i] = sin(2.0 * M_PI * i / N);
+    }
+    modes.clear();
+    std::vector<double> w_dot(m), z(m), z_dot(m), s_z(N), power(N / 2 + 1);
+    for (int mode = 0; mode < m; mode += 2) {
+        // dz/dt = J L (L z), so J L w and J L A w span the plane of the mode
+        for (int a = 0; a < m; a++) {
+            double sum = 0.0;
+            for (int c = 0; c < m; c++) {
+                sum += A[(size_t) a * m + c] * V[(size_t) c * m + mode];
+            }
+            w_dot[a] = sum;
+        }
+        for (int a = 0; a < N; a++) {
+            double x = 0.0, y = 0.0, x_dot = 0.0, y_dot = 0.0;
+            for (int c = 0; c < m; c++) {
+                x += l_at(a, c) * V[(size_t) c * m + mode];
+                y += l_at(N + a, c) * V[(size_t) c * m + mode];
+                x_dot += l_at(a, c) * w_dot[c];
+                y_dot += l_at(N + a, c) * w_dot[c];
+            }
+            z[a] = y;
+            z[N + a] = -x;
+            z_dot[a] = y_dot;
+            z_dot[N + a] = -x_dot;
+        }
+        // a zero-energy mode doesn't move, w itself is the rigid rotation
+        double speed = 0.0;
+        for (int a = 0; a < m; a++) {
+            speed += z[a] * z[a];
+        }
+        if (speed < 1e-12 * max_lambda) {
+            for (int a = 0; a < m; a++) {
+                z[a] = V[(size_t) a * m + mode];
+            }
+        }
+
+        // share of the mode in S_z, and its spectrum over k
+        double weight = 0.0;
+        for (int j = 0; j <= N / 2; j++) {
+            power[j] = 0.0;
+        }
+        for (const std::vector<double>* plane : { &z, &z_dot }) {
+            const std::vector<double>& q = *plane;
+            double norm = 0.0;
+            double s_z_sq = 0.0;
+            for (int i = 0; i < N; i++) {
+                s_z[i] = q[i] * e1[i].z + q[N + i] * e2[i].z;
+                norm += q[i] * q[i] + q[N + i] * q[N + i];
+                s_z_sq += s_z[i] * s_z[i];
+            }
+            if (norm == 0.0) {
+                continue;
+            }
+            weight += 0.5 * s_z_sq / norm;
+            for (int j = 0; j <= N / 2; j++) {
+                double re = 0.0, im = 0.0;
+                for (int i = 0; i < N; i++) {
+                    int phase = (int) (((long) i * j) % N);
+                    re += s_z[i] * cos_table[phase];
+                    im -= s_z[i] * sin_table[phase];
+                }
+                power[j] += (re * re + im * im) / norm;
+            }
+        }
+        int best = 0;
+        for (int j = 1; j <= N / 2; j++) {
+            if (power[j] > power[best]) {
+                best = j;
+            }
+        }
+        float energy = (float) sqrt(fmax(omega_sq[mode], 0.0));
+        modes.push_back((SpinWaveMode) { (float) (2.0 * M_PI * best / N), energy, (float) weight });
+    }
+    return true;
+}
+
+// LINEAR SPIN WAVES OF A RELAXED STATE, ANALYTIC WHEN POSSIBLE
+// PARAMS: (relaxed spins), (pointer to simulation params), (output modes)
+// RETURNS: false if the modes couldn't be computed
+bool LinearSpinWaves(const FirstTouchVector<Particle>& ground_state, Params* params, std::vector<SpinWaveMode>& modes) {
+    float spread;
+    float Q = SpiralPitch(ground_state, params, &spread);
+    if (!params->dipolar_on && !params->ext_field_on && !params->open_ends && spread < 1e-3f) {
+        printf("Uniform spiral with pitch Q = %f, using the analytic dispersion\n", Q);
+        modes = AnalyticSpinWaves(Q, params);
+        return true;
+    }
+    return HolsteinPrimakoffSpinWaves(ground_state, params, modes);
+}
+
+// WRITE THE MODES NEXT TO THE SPECTRUM OF DataLogger::analyze
+// k_bin is the column and omega_bin the row of the mode in the spectrum csv
+// PARAMS: (path of the csv), (modes), (pointer to simulation params)
+// RETURNS: false if the file couldn't be written
+bool WriteSpinWaves(const char* path, const std::vector<SpinWaveMode>& modes, Params* params) {
+    FILE* filePtr = fopen(path, "w");
+    if (filePtr == nullptr) {
+        perror("Couldn't create the spin wave file");
+        return false;
+    }
+    int N = params->n_of_particles;
+    fprintf(filePtr, "k,energy_meV,weight,k_bin,omega_bin\n");
+    for (const SpinWaveMode& mode : modes) {
+        int k_bin = (int) lroundf(mode.k * N / (2.0f * M_PI));
+        int omega_bin = (int) lroundf(mode.energy / params->energy_resolution);
+        fprintf(filePtr, "%f,%f,%f,%d,%d\n", mode.k, mode.energy, mode.weight, k_bin, omega_bin);
+    }
+    fclose(filePtr);
+    return true;
+}
@@ -0,0 +1,115 @@
+#include "ThreadPool.h"
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// index of the worker running on this thread, -1 outside the pool
+static thread_local int worker_index = -1;
+static thread_local ThreadPool* worker_pool = nullptr;
+
+ThreadPool::ThreadPool(int workers) {
+    if (workers < 1) {
+        workers = 1;
+    }
+    for (int w = 0; w < workers; w++) {
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (int w = 0; w < workers; w++) {
+        threads.emplace_back(&ThreadPool::work, this, w);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+int ThreadPool::size() const {
+    return (int) queues.size();
+}
+
+// TASKS SUBMITTED OR RUNNING THAT HAVEN'T FINISHED
+long ThreadPool::pending() const {
+    return unfinished.load();
+}
+
+// QUEUE A TASK
+// From a worker of this pool the task goes to its own queue, otherwise round robin.
+// PARAMS: (the task)
+void ThreadPool::submit(std::function<void()> task) {
+    int target = (worker_pool == this) ? worker_index : (int) (next_queue++ % queues.size());
+    unfinished++;
+    {
+        std::lock_guard<std::mutex> guard(queues[target]->lock);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+    }
+    wake.notify_one();
+}
+
+// WAIT UNTIL EVERY TASK, INCLUDING THE ONES THEY SUBMITTED, HAS FINISHED
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> guard(sleep_lock);
+    done.wait(guard, [&]() { return unfinished.load() == 0; });
+}
+
+// TAKE A TASK, NEWEST FROM THE OWN QUEUE OR OLDEST FROM ANOTHER
+// PARAMS: (index of the worker), (output task)
+// RETURNS: true if a task was found
+bool ThreadPool::take(int self, std::function<void()>& task) {
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    int n = (int) queues.size();
+    for (int offset = 1; offset < n; offset++) {
+        Queue& victim = *queues[(self + offset) % n];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::work(int self) {
+    worker_index = self;
+    worker_pool = this;
+    while (true) {
+        std::function<void()> task;
+        if (take(self, task)) {
+            task();
+            if (--unfinished == 0) {
+                std::lock_guard<std::mutex> guard(sleep_lock);
+                done.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        if (stopping) {
+            return;
+        }
+        // tasks queued while this worker was looking are caught by the timeout
+        wake.wait_for(guard, std::chrono::milliseconds(10));
+        if (stopping) {
+            return;
+        }
+    }
+}
@@ -7,6 +7,15 @@
 #include "utils.h"
 #include <math.h>
 #include "DataLogger.h"
+#include "SpinWaves.h"
+#include "GroundStateLibrary.h"
+#include "Simulation.h"
+#include "AdaptiveStepper.h"
+#include "LiveExport.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <chrono>
+#include <fftw3.h>
 
 
 int main(void) {
@@ -17,10 +26,10 @@ int main(void) {
     Params params;
     bool start = false;
     bool found_ground_state = false;
-	std::vector<Particle> ground_state;
+	FirstTouchVector<Particle> ground_state;
     bool recording = false;
     float pulse_start_time = 0.0f;
-    std::vector<Particle> particles;
+    FirstTouchVector<Particle> particles;
     std::vector<float> energyPlot(1000);
 	int energy_plot_counter = 0;
 	std::vector<float> spinZPlot;
@@ -29,7 +38,17 @@ int main(void) {
     float rec_start_time = 0.0f;
     float rec_end_time = 0.0f;
 	int steps_per_frame = 1;
-	int rec_counter = 0;
+	int pulses_left = 0;
+	std::vector<SpinWaveMode> spin_waves;
+	std::vector<float> spinWavePlot;
+	GroundStateLibrary library("ground_states");
+	bool warm_start = true;
+	AdaptiveStepper stepper;
+	LiveExport live;
+	// long measurements run here, so the window keeps drawing
+	std::atomic<bool> measuring{false};
+	ThreadPool background(1);
+	fftwf_make_planner_thread_safe();
 
 	// init camera for animation
     Camera3D camera = { 0 };
@@ -46,21 +65,30 @@ int main(void) {
             if (start) {
 				for (int i = 0; i < steps_per_frame; i++) {
 					// Run physics
-                	MinimizeEnergy(particles, &params);
+                	stepper.advance(particles, &params);
 
                     // Record and analyze data
                     if ((rec_end_time != 0.0f) && (current_time >= rec_start_time)) {
-                        if (current_time < rec_end_time && rec_counter == 50) {
-                            logger->listen(spinZPlot, &params);
-							rec_counter = 0;
+                        if (current_time < rec_end_time) {
+                            logger->record(particles.data(), &params);
+                        }
+                        else if (current_time >= rec_end_time && pulses_left > 0) {
+                            // Fire the next pulse, the spectrum keeps accumulating
+                            pulses_left--;
+                            pulse_start_time = current_time;
+                            params.ext_field_on = true;
+                            printf("Adding magnetic pulse, %d more to go!\n", pulses_left);
+                            ground_state = particles;
+                            logger->next_block(ground_state);
+                            rec_end_time = 0.0f;
                         }
                         else if (current_time >= rec_end_time) {
                             logger->analyze(&params);
                             printf("Simulation finished! Thank you and goodbye.\n");
 							rec_end_time = 0.0f;
 							delete logger;
+							logger = nullptr;
 						}
-						rec_counter++;
 					}
 
 					// Increment time
@@ -95,11 +123,54 @@ int main(void) {
 	                ImGui::SliderFloat("Pulse lenght:", &params.ext_field_pulse_lenght, 0.1f, 5.0f);
 	                ImGui::SliderFloat("Field radius", &params.external_field_radius, 5.0f, 10.0f);
 	                ImGui::SliderFloat("Energy resolution", &params.energy_resolution, 0.001f, 0.005f);
+	                ImGui::SliderInt("Welch segments", &params.welch_segments, 1, 16);
+	                ImGui::SliderInt("Pulses", &params.pulse_repeats, 1, 16);
+	                ImGui::Checkbox("Record in the local frame", &params.local_frame_on);
+	                ImGui::InputInt("Analysis memory (MB, 0 = any)", &params.analysis_memory_mb);
+	                const char* codecs[] = { "float32", "int16", "float16" };
+	                ImGui::Combo("Snapshot storage", &params.snapshot_codec, codecs, 3);
+	                ImGui::InputFloat("int16 tolerance (0 = finest)", &params.snapshot_tolerance, 0.0f, 0.0f, "%.1e");
+	                ImGui::Checkbox("Zoom window", &params.zoom_on);
+	                ImGui::DragFloatRange2("Zoom k", &params.zoom_k_min, &params.zoom_k_max, 0.01f, params.local_frame_on ? -M_PI : 0.0f, M_PI);
+	                ImGui::DragFloatRange2("Zoom energy (meV)", &params.zoom_energy_min, &params.zoom_energy_max, 0.01f, -10.0f, 10.0f);
+	                ImGui::SliderInt("Zoom rows", &params.zoom_rows, 16, 2000);
+	                ImGui::SliderInt("AR order (0 = chirp-z)", &params.zoom_ar_order, 0, 64);
+	                ImGui::Checkbox("Dispersion table", &params.dispersion_on);
+	                ImGui::SliderFloat("Smoothing energy (rows)", &params.dispersion_sigma_energy, 0.0f, 5.0f);
+	                ImGui::SliderFloat("Smoothing k (bins)", &params.dispersion_sigma_k, 0.0f, 5.0f);
+	                ImGui::SliderInt("Peaks per k (0 = all)", &params.dispersion_peaks, 0, 8);
+	                ImGui::InputFloat("Log floor", &params.dispersion_floor, 0.0f, 0.0f, "%.1e");
+	                ImGui::InputFloat("Peak threshold", &params.dispersion_threshold, 0.0f, 0.0f, "%.1e");
+	                ImGui::Checkbox("Dipolar coupling", &params.dipolar_on);
+	                ImGui::SliderFloat("Dipolar D", &params.dipolar_D, 0.0f, 0.1f);
+	                ImGui::Checkbox("Thermal noise", &params.thermal_on);
+	                ImGui::SliderFloat("Temperature (K)", &params.temperature, 0.0f, 50.0f);
 				    ImGui::InputInt("Number of particles", &params.n_of_particles);
+	                ImGui::Checkbox("Adaptive time step", &params.adaptive_on);
+	                ImGui::InputFloat("Spin tolerance", &params.spin_tolerance, 0.0f, 0.0f, "%.1e");
+	                ImGui::Checkbox("Open ends", &params.open_ends);
+	                ImGui::SliderInt("Absorber width", &params.sponge_width, 2, 100);
+	                ImGui::Checkbox("Graded absorber (PML)", &params.pml_on);
+	                ImGui::InputFloat("PML reflection", &params.pml_reflection, 0.0f, 0.0f, "%.1e");
+	                ImGui::SliderInt("PML order", &params.pml_order, 1, 4);
+	                const char* affinities[] = { "OS", "compact", "spread" };
+	                ImGui::Combo("Thread pinning", &params.affinity, affinities, 3);
+	                ImGui::SliderInt("Multigrid levels", &params.multigrid_levels, 0, 8);
+	                ImGui::Checkbox("Warm start from ground_states/", &warm_start);
+	                ImGui::Checkbox("Live export to " LIVE_DEFAULT_NAME, &params.live_export_on);
+	                ImGui::SliderFloat("Export interval (ps)", &params.live_export_interval_ps, 0.01f, 10.0f);
 	                if (ImGui::Button("Start")) {
 	                    start = !start;
 					    if (start) {
-						    InitParticles(particles, &params);
+						    stepper.reset();
+						    live.close();
+						    // before the chain is allocated, so its pages land next to the threads using them
+						    PinThreads(params.affinity);
+						    if (!warm_start || !library.warm_start(particles, &params)) {
+							    InitParticles(particles, &params);
+							    // the long-wavelength part of the ground state, from shorter chains
+							    CoarseToFine(particles, &params, 1000000);
+						    }
 	                        spinZPlot.resize(params.n_of_particles, 0.0f);
 	                        printf("Looking for ground state...\n");
 					    }
@@ -121,6 +192,9 @@ int main(void) {
 						printf("Current: %f.2 -- Target: %f.2\n", sum, min_sum);
 						if (sum < min_sum) {
 		                    printf("Found ground state! Removed precession damping.\n");
+		                    if (warm_start) {
+		                        library.store(particles, &params);
+		                    }
 			                params.damping = 0.00001f;
 	    	                params.dt_ps = 0.001f;
 							steps_per_frame = 300;
@@ -133,6 +207,19 @@ int main(void) {
 					}
 	                energyPlot[energy_plot_counter] = current_energy;
 					energy_plot_counter++;
+
+	                // Publish the spins for outside tools
+	                if (params.live_export_on && !live.is_open()) {
+	                    if (!live.open(LIVE_DEFAULT_NAME, params.n_of_particles, 0, params.n_of_particles, 16, &params)) {
+	                        params.live_export_on = false;
+	                    }
+	                }
+	                else if (!params.live_export_on && live.is_open()) {
+	                    live.close();
+	                }
+	                if (live.due(current_time, &params)) {
+	                    live.publish(particles.data(), current_time, current_energy, found_ground_state ? 0u : LIVE_RELAXING, &params);
+	                }
 	                ImGui::Begin("Energy");
 	                    ImGui::Text("Total energy: %.4f meV", current_energy);
 	                    ImGui::Text("Current damping: %f.2", params.damping);
@@ -145,6 +232,9 @@ int main(void) {
 	                    // Clock
 	                    ImGui::Begin("Clock");
 	                        ImGui::Text("%.4f ns", current_time / 1000.0f);
+	                        if (params.adaptive_on) {
+	                            ImGui::Text("Step %.2e ps, %ld steps, %ld rejected", stepper.current_step(), stepper.steps(), stepper.rejections());
+	                        }
 	                    ImGui::End();
 
 	                    // S_z plot
@@ -160,20 +250,94 @@ int main(void) {
 	                        if (ImGui::Button("Magnetic pulse")) {
 	                            pulse_start_time = current_time;
 	                            params.ext_field_on = true;
+	                            pulses_left = params.pulse_repeats - 1;
 	                            printf("Adding magnetic pulse of lenght %f.2!\n", params.ext_field_pulse_lenght);
 								ground_state = particles;
 	                        }
 	                        ImGui::Text("Field status: %s", params.ext_field_on ? "on" : "off");
 	                    ImGui::End();
+
+	                    // Linear spin waves of the current state, no recording needed
+	                    ImGui::Begin("Linear spin waves");
+	                        if (ImGui::Button("Compute dispersion")) {
+	                            auto t0 = std::chrono::steady_clock::now();
+	                            if (LinearSpinWaves(particles, &params, spin_waves)) {
+	                                float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	                                printf("Found %zu modes in %.1f ms, saved to result_lswt.csv\n", spin_waves.size(), ms);
+	                                WriteSpinWaves("result_lswt.csv", spin_waves, &params);
+	                                // lowest mode at every k for the plot
+	                                spinWavePlot.assign(params.n_of_particles / 2 + 1, FLT_MAX);
+	                                for (const SpinWaveMode& mode : spin_waves) {
+	                                    int k_bin = (int) lroundf(mode.k * params.n_of_particles / (2.0f * M_PI));
+	                                    spinWavePlot[k_bin] = fminf(spinWavePlot[k_bin], mode.energy);
+	                                }
+	                                for (float& energy : spinWavePlot) {
+	                                    if (energy == FLT_MAX) energy = 0.0f;
+	                                }
+	                            }
+	                        }
+	                        if (!spinWavePlot.empty()) {
+	                            ImGui::PlotLines("hbar omega(k)", spinWavePlot.data(), spinWavePlot.size(), 0, "meV", FLT_MAX, FLT_MAX, ImVec2(0, 150));
+	                        }
+	                    ImGui::End();
+
+	                    // Reflection of the absorbing layers, measured with wave packets on the current state
+	                    ImGui::Begin("Absorbing boundaries");
+	                        ImGui::Text("Peak damping: %.3f", AbsorberPeakDamping(&params));
+	                        if (measuring) {
+	                            ImGui::Text("Measuring reflection...");
+	                        }
+	                        else if (ImGui::Button("Measure reflection")) {
+	                            // on a copy of the current state, the simulation goes on meanwhile
+	                            measuring = true;
+	                            background.submit([&measuring, state = particles, settings = params]() mutable {
+	                                FILE* file = fopen("result_reflection.csv", "w");
+	                                if (file != nullptr) {
+	                                    fprintf(file, "k,energy_meV,reflection\n");
+	                                }
+	                                for (int j = 1; j <= 8; j++) {
+	                                    float k = j * M_PI / 9.0f;
+	                                    float energy;
+	                                    float reflection = MeasureReflection(state, &settings, k, &energy);
+	                                    printf("k = %.3f, E = %.3f meV, reflection %.2e\n", k, energy, reflection);
+	                                    if (file != nullptr) {
+	                                        fprintf(file, "%f,%f,%e\n", k, energy, reflection);
+	                                    }
+	                                }
+	                                if (file != nullptr) {
+	                                    fclose(file);
+	                                }
+	                                measuring = false;
+	                            });
+	                        }
+	                    ImGui::End();
 	                    if (params.ext_field_on && (current_time - pulse_start_time > params.ext_field_pulse_lenght) ) {
 	                        printf("Done!\n");
 	                        params.ext_field_on = false;
 	                        float recording_time = (2 * M_PI * params.hbar) / params.energy_resolution;
-	                        int size_hint = (int) (recording_time / params.dt_ps);
-	                        rec_end_time = current_time + recording_time;
+	                        bool averaging = params.welch_segments > 1 || params.pulse_repeats > 1;
+	                        int stride = DataLogger::recording_stride(&params);
+	                        int segment_snapshots = (int) (recording_time / (stride * params.dt_ps));
+	                        if (averaging) {
+	                            // every segment keeps the full energy resolution
+	                            recording_time *= 1.0f + (params.welch_segments - 1) * (1.0f - params.welch_overlap);
+	                        }
+	                        size_t size_hint = (size_t) (recording_time / (stride * params.dt_ps)) * params.n_of_particles;
                             rec_start_time = current_time + 20.0f;
+	                        rec_end_time = rec_start_time + recording_time;
 							printf("Recording from %f.2 to %f.2...\n", rec_start_time, rec_end_time);
-							logger = new DataLogger(size_hint, ground_state);
+							if (logger == nullptr) {
+								logger = new DataLogger(size_hint, ground_state);
+								logger->overlay(spin_waves);
+								logger->plan_recording(&params);
+								if (averaging && !logger->plan_segments(segment_snapshots, &params)) {
+									printf("Couldn't plan the segments, recording cancelled\n");
+									delete logger;
+									logger = nullptr;
+									rec_end_time = 0.0f;
+									pulses_left = 0;
+								}
+							}
 
 	                    }
 
@@ -1,87 +1,254 @@
 #include "utils.h"
+#include "DipolarField.h"
+#include "SpinWaves.h"
+#include "rng.h"
 #include <vector>
 #include "raylib.h"
 #include <math.h>
 
+// EXCHANGE FIELD FROM THE TWO NEIGHBOURS ON EACH SIDE OF A SITE
+// PARAMS: (spins at i-2, i-1, i+1, i+2), (pointer to simulation params)
+// RETURNS: the J1/J2 part of the effective field
+Vector3 ExchangeField(Vector3 l2, Vector3 l1, Vector3 r1, Vector3 r2, Params* params) {
+    Vector3 H = Vector3Zero();
+
+    // Nearest neighbour term
+    Vector3 J1 = Vector3Add(l1, r1);
+    H = Vector3Add(H, Vector3Scale(J1, -params->J1));
+
+    // Next nearest neighbour term
+    Vector3 J2 = Vector3Add(l2, r2);
+    H = Vector3Add(H, Vector3Scale(J2, -params->J2));
+
+    return H;
+}
+
+// ZEEMAN FIELD OF THE PULSE AT A POSITION
+// PARAMS: (position of the site), (pointer to simulation params)
+// RETURNS: the field from the external pulse (zero outside the disk or when the field is off)
+Vector3 ZeemanField(Vector3 pos, Params* params) {
+    if (pos.x >= (50.0f - params->external_field_radius) && pos.x <= (50.0f + params->external_field_radius) && params->ext_field_on) {
+        float dist = pos.x - 50.0f;
+        float sigma = params->external_field_radius / params->ext_field_sigma;
+        float gaussian = expf( -powf(dist, 2) / (2.0f * sigma * sigma) );
+
+        return Vector3Scale((Vector3) {0.0f, 0.0f, params->external_field * gaussian}, params->gm_ratio * params->bohr_magneton);
+    }
+    return Vector3Zero();
+}
+
 // CALCULATE THE EFFECTIVE MAGNETIC FIELD STRENGHT OF A SITE
 // PARAMS: (index of the site), (reference to a vector of the sites), (pointer to simulation params)
 // RETURNS: the effective field strenght as a vector
-Vector3 CalculateH_eff(int i, const std::vector<Particle>& particles, Params* params) {
+Vector3 CalculateH_eff(int i, const FirstTouchVector<Particle>& particles, Params* params) {
 
-    // Circular handling of the edges
+    // Circular handling of the edges, or no neighbour past the ends of an open chain
     auto handle_edges = [&](int idx) {
         int N = params->n_of_particles;
+        if (params->open_ends && (idx < 0 || idx >= N)) {
+            return Vector3Zero();
+        }
         int wrap = (idx % N + N) % N;
         return particles[wrap].spin;
     };
 
-    Vector3 H = Vector3Zero();
-
-    // Nearest neighbour term
-    Vector3 J1 = Vector3Add(handle_edges(i-1), handle_edges(i+1));
-    H = Vector3Add(H, Vector3Scale(J1, -params->J1));
-
-    // Next nearest neighbour term
-    Vector3 J2 = Vector3Add(handle_edges(i-2), handle_edges(i+2));
-    H = Vector3Add(H, Vector3Scale(J2, -params->J2));
+    Vector3 H = ExchangeField(handle_edges(i-2), handle_edges(i-1), handle_edges(i+1), handle_edges(i+2), params);
 
     // Zeeman term
-    if (particles[i].pos.x >= (50.0f - params->external_field_radius) && particles[i].pos.x <= (50.0f + params->external_field_radius) && params->ext_field_on) {
-        float dist = particles[i].pos.x - 50.0f;
-        float sigma = params->external_field_radius / params->ext_field_sigma;
-        float gaussian = expf( -powf(dist, 2) / (2.0f * sigma * sigma) );
+    H = Vector3Add(H, ZeemanField(particles[i].pos, params));
+
+    return H;
+}
 
-        Vector3 zeemann = Vector3Scale((Vector3) {0.0f, 0.0f, params->external_field * gaussian}, params->gm_ratio * params->bohr_magneton);
-        H = Vector3Add(H, zeemann);
+// PEAK DAMPING OF THE ABSORBING LAYERS AT THE ENDS OF THE CHAIN
+// The fixed sponge peaks at 0.5. The graded layers (PML) are designed like the perfectly matched
+// layers of wave solvers: a wave of frequency omega and group velocity v_g decays by damping *
+// omega / v_g per site, so with damping = peak * depth^order a round trip through a layer of
+// width W leaves exp(-2 peak W (omega / v_g) / (order + 1)) of the amplitude. The peak is set
+// so this equals pml_reflection for the worst absorbed wave of the classical dispersion that
+// is shorter than the layer and above 5% of max_energy.
+// PARAMS: (pointer to simulation params)
+// RETURNS: the damping added at the outermost site
+float AbsorberPeakDamping(Params* params) {
+    if (!params->pml_on) {
+        return 0.5f;
+    }
+    int width = (params->sponge_width > 1) ? params->sponge_width : 1;
+    double Q = ClassicalPitch(params->J1, params->J2);
+    double k_min = fmin(2.0 * M_PI / width, M_PI);
+    double min_ratio = 1e30;
+    int samples = 256;
+    for (int s = 0; s <= samples; s++) {
+        double k = k_min + (M_PI - k_min) * s / samples;
+        double energy = SpiralEnergy(k, Q, params);
+        if (energy < 0.05 * params->max_energy) {
+            continue;
+        }
+        double dk = 1e-4;
+        double velocity = fabs(SpiralEnergy(k + dk, Q, params) - SpiralEnergy(k - dk, Q, params)) / (2.0 * dk);
+        if (velocity > 0.0) {
+            min_ratio = fmin(min_ratio, energy / velocity);
+        }
+    }
+    if (min_ratio == 1e30) {
+        return 0.5f;
     }
+    return (float) ((params->pml_order + 1) * log(1.0 / params->pml_reflection) / (2.0 * width * min_ratio));
+}
 
-    return H;
+// DAMPING OF A SITE INCLUDING THE "SPONGE" AT THE ENDS OF THE CHAIN
+// peak * depth^order across the last sponge_width sites, quadratic for the fixed sponge
+// PARAMS: (global index of the site), (global number of sites), (AbsorberPeakDamping), (pointer to simulation params)
+// RETURNS: the damping coefficient of the site
+float SpongeDamping(long i, long N, float peak_damping, Params* params) {
+    int sponge_width = params->sponge_width;
+    float order = params->pml_on ? (float) params->pml_order : 2.0f;
+    if (i <= sponge_width) {
+        float how_close = ((float) i) / ((float) sponge_width);
+        return params->damping + (peak_damping * powf(1.0f - how_close, order));
+    }
+    else if (i >= N - sponge_width) {
+        float how_close = ((float) (N - 1 - i)) / ((float) sponge_width);
+        return params->damping + (peak_damping * powf(1.0f - how_close, order));
+    }
+    return params->damping;
 }
-// INTEGRATOR: UPDATE THE SPINS TO THE NEXT TIME STEP
-// PARAMS: (reference to vector of the sites), (pointer to simulation params)
-void MinimizeEnergy(std::vector<Particle>& particles, Params* params) {
-    float damping = params->damping;
+
+// TIME DERIVATIVE OF A SPIN FROM THE LANDAU-LIFSHITZ EQUATION
+// PARAMS: (effective field), (spin), (damping of the site), (pointer to simulation params)
+// RETURNS: dS/dt
+Vector3 LLGDerivative(Vector3 H, Vector3 S, float damping, Params* params) {
     float gamma = 1 / params->hbar;
-    float dt = params->dt_ps;
+    Vector3 torque = Vector3Scale(Vector3CrossProduct(S, H), -gamma);
+    Vector3 CP = Vector3CrossProduct(S, H);
+    Vector3 gilbert_damping = Vector3Scale(
+        Vector3CrossProduct(S, CP),
+        -gamma * damping
+    );
+    return Vector3Add(torque, gilbert_damping);
+}
+
+// THERMAL FIELD OF A SITE FOR THE CURRENT STEP
+// Gaussian white noise with <H_a H_b> = 2 damping k_B T / gamma per unit time, drawn from
+// the counter-based generator keyed by (seed, site, step). The predictor and the corrector
+// of a step see the same field (Heun scheme for the Stratonovich equation).
+// PARAMS: (global index of the site), (damping of the site), (pointer to simulation params)
+// RETURNS: the thermal field
+Vector3 ThermalField(long i, float damping, Params* params) {
+    float variance = 2.0f * damping * params->k_B * params->temperature * params->hbar / params->dt_ps;
+    Vector3 noise = PhiloxGaussian3(params->rng_seed, RNG_STREAM_THERMAL, (uint64_t) i, params->step_counter);
+    return Vector3Scale(noise, sqrtf(variance));
+}
+
+// INITIAL SPIN OF A SITE THAT ONLY DEPENDS ON (seed, site)
+// The same random start as InitParticles, but reproducible and independent of how the
+// chain is split between threads, processes or jobs.
+// PARAMS: (global index of the site), (number of sites in the chain), (seed)
+// RETURNS: the site
+Particle InitialSite(long i, long N, uint32_t seed) {
+    // theta ~ N(pi, 1.5) as in InitParticles
+    double theta = M_PI + 1.5 * PhiloxGaussian3(seed, RNG_STREAM_INIT, (uint64_t) i, 0).x;
+    float distance = 100.0f / N;
+    return (Particle) {
+        (Vector3) { (float) i * distance, 0, 0 },
+        (Vector3) { (float) cos(theta), (float) sin(theta), 0 }
+    };
+}
+
+// Plans and buffers of the dipolar term, reused between steps (one set per thread, so
+// independent simulations can run side by side)
+static thread_local DipolarField dipolar_field;
+
+// Everything the damping profile depends on, it is only rebuilt when one of them changes
+struct AbsorberSettings {
+	int N = -1;
+	float damping;
+	int sponge_width;
+	bool pml_on;
+	float pml_reflection;
+	int pml_order;
+	float J1, J2, max_energy; // the dispersion the graded layers are designed for
+
+	bool operator==(const AbsorberSettings& other) const {
+		return N == other.N && damping == other.damping && sponge_width == other.sponge_width
+		       && pml_on == other.pml_on && pml_reflection == other.pml_reflection && pml_order == other.pml_order
+		       && J1 == other.J1 && J2 == other.J2 && max_energy == other.max_energy;
+	}
+};
+
+// Arrays of a step, kept between steps so their pages stay where the first touch put them
+// (Numa.h). Every loop over them is schedule(static), the partitioning of that first touch.
+struct StepWorkspace {
+	FirstTouchVector<Particle> predictions;
+	FirstTouchVector<Vector3> new_spins;
+	FirstTouchVector<Vector3> dipolar;
+	FirstTouchVector<Vector3> thermal;
+	FirstTouchVector<float> damping_profile;
+	AbsorberSettings damping_settings; // damping_profile was built for these
+	FirstTouchVector<Vector3> derivatives; // for MinimizeEnergy
+};
+static thread_local StepWorkspace workspace;
+
+// ONE PREDICTOR-CORRECTOR STEP OF ANY LENGTH
+// The Euler predictor and the corrected (Heun) spins form an embedded pair of first and second
+// order, so their difference estimates the local error of the step.
+// PARAMS: (reference to vector of the sites), (length of the step), (output: sites after the step),
+// (output: dS/dt at the start of the step), (pointer to simulation params)
+// RETURNS: the largest distance between the predicted and the corrected spin of a site
+float HeunStep(const FirstTouchVector<Particle>& particles, float dt, FirstTouchVector<Particle>& result,
+               FirstTouchVector<Vector3>& derivatives, Params* params) {
     int N = params->n_of_particles;
 
-    std::vector<Particle> predictions = particles;
-	std::vector<Vector3> derivatives(N);
-	std::vector<Vector3> new_spins(N);
-	std::vector<float> damping_profile;
+    FirstTouchVector<Particle>& predictions = workspace.predictions;
+	FirstTouchVector<Vector3>& new_spins = workspace.new_spins;
+	FirstTouchVector<Vector3>& dipolar = workspace.dipolar;
+	FirstTouchVector<Vector3>& thermal = workspace.thermal;
+	FirstTouchVector<float>& damping_profile = workspace.damping_profile;
+	predictions.resize(N);
+	derivatives.resize(N);
+	new_spins.resize(N);
+	dipolar.resize(N);
+	thermal.resize(N);
+	result.resize(N);
 
-	if (damping_profile.size() != N) {
-		int sponge_width = params->sponge_width;
-        float max_damping = 0.5f;
-		damping_profile.resize(N, damping);
+	// Damping of the absorbers, rebuilt only when the chain or its settings change
+	AbsorberSettings settings = { N, params->damping, params->sponge_width, params->pml_on, params->pml_reflection,
+	                              params->pml_order, params->J1, params->J2, params->max_energy };
+	if (!(settings == workspace.damping_settings)) {
+		damping_profile.resize(N);
+		float peak_damping = AbsorberPeakDamping(params);
+		#pragma omp parallel for schedule(static)
 		for (int i = 0; i < N; i++) {
-			if (i <= sponge_width) {
-            	float how_close = ((float) i) / ((float) sponge_width);
-            	damping_profile[i] = damping + (max_damping * powf(1.0f - how_close, 2));
-        	}
-	 	    else if (i >= N - sponge_width) {
-	        	float how_close = ((float) (N - 1 - i)) / ((float) sponge_width);
-	            damping_profile[i] = damping + (max_damping * powf(1.0f - how_close, 2));
-        	}
+			damping_profile[i] = SpongeDamping(i, N, peak_damping, params);
+		}
+		workspace.damping_settings = settings;
+	}
+
+	// The thermal field (kept for the corrector)
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < N; i++) {
+		thermal[i] = params->thermal_on ? ThermalField(i, damping_profile[i], params) : Vector3Zero();
+		predictions[i].pos = particles[i].pos;
+		if (!params->dipolar_on) {
+			dipolar[i] = Vector3Zero();
 		}
 	}
 
 	// Helper to compute derivative
 	auto compute_derivative = [&](Vector3 H, Vector3 S, int idx) {
-        Vector3 torque = Vector3Scale(Vector3CrossProduct(S, H), -gamma);
-        Vector3 CP = Vector3CrossProduct(S, H);
-        Vector3 gilbert_damping = Vector3Scale(
-            Vector3CrossProduct(S, CP),
-            -gamma * damping_profile[idx]
-        );
-        Vector3 dS = Vector3Add(torque, gilbert_damping);
-		return dS;
+		return LLGDerivative(H, S, damping_profile[idx], params);
 	};
 
+	// Dipolar field of the whole chain, zero when the term is off
+	if (params->dipolar_on) {
+		dipolar_field.compute(particles, params, dipolar);
+	}
+
     // Calculate new spins after time step
-	#pragma omp parallel for
+	#pragma omp parallel for schedule(static)
     for (int i = 0; i < N; i++) {
-        Vector3 H = CalculateH_eff(i, particles, params);
+        Vector3 H = Vector3Add(CalculateH_eff(i, particles, params), dipolar[i]);
+        H = Vector3Add(H, thermal[i]);
         Vector3 S = particles[i].spin;
         Vector3 dS = compute_derivative(H, S, i);
 
@@ -89,10 +256,15 @@ void MinimizeEnergy(std::vector<Particle>& particles, Params* params) {
         predictions[i].spin = Vector3Normalize(Vector3Add(S, Vector3Scale(dS, dt)));
     };
 
+	if (params->dipolar_on) {
+		dipolar_field.compute(predictions, params, dipolar);
+	}
+
 	// Calculate derivative after another timestep and average them
-	#pragma omp parallel for
+	#pragma omp parallel for schedule(static)
 	for (int i = 0; i < N; i++) {
-		Vector3 H = CalculateH_eff(i, predictions, params);
+		Vector3 H = Vector3Add(CalculateH_eff(i, predictions, params), dipolar[i]);
+		H = Vector3Add(H, thermal[i]);
         Vector3 S = predictions[i].spin;
 		Vector3 dS = compute_derivative(H, S, i);
 
@@ -101,24 +273,46 @@ void MinimizeEnergy(std::vector<Particle>& particles, Params* params) {
 	};
 
 	// update spins
+	float error = 0.0f;
+	#pragma omp parallel for schedule(static) reduction(max:error)
 	for (int i = 0; i < N; i++) {
-		particles[i].spin = Vector3Normalize(new_spins[i]);
+		result[i].pos = particles[i].pos;
+		result[i].spin = Vector3Normalize(new_spins[i]);
+		error = fmaxf(error, Vector3Distance(result[i].spin, predictions[i].spin));
 	}
+	params->step_counter++;
+	return error;
+}
+
+// INTEGRATOR: UPDATE THE SPINS TO THE NEXT TIME STEP
+// PARAMS: (reference to vector of the sites), (pointer to simulation params)
+void MinimizeEnergy(FirstTouchVector<Particle>& particles, Params* params) {
+	HeunStep(particles, params->dt_ps, particles, workspace.derivatives, params);
 }
 
 // CALCULATE TOTAL ENERGY OF THE SYSTEM
 // PARAMS: (reference to a vector of the sites), (pointer to the simulation params)
-float getTotalEnergy(const std::vector<Particle>& particles, Params* params) {
+float getTotalEnergy(const FirstTouchVector<Particle>& particles, Params* params) {
     float result = 0.0f;
     int N = params->n_of_particles;
 
     auto handle_edges = [&](int idx) {
+        if (params->open_ends && idx >= N) {
+            return Vector3Zero();
+        }
         int wrap = (idx % N + N) % N;
         return particles[wrap].spin;
     };
-	#pragma omp parallel for reduction(+:result)
+	FirstTouchVector<Vector3> dipolar;
+	if (params->dipolar_on) {
+		dipolar_field.compute(particles, params, dipolar);
+	}
+	#pragma omp parallel for schedule(static) reduction(+:result)
     for (int i = 0; i < N; i++) {
         Vector3 S = particles[i].spin;
+        if (params->dipolar_on) {
+            result -= 0.5f * Vector3DotProduct(S, dipolar[i]);
+        }
 
         result += params->J1 * Vector3DotProduct(S, handle_edges(i + 1));
         result += params->J2 * Vector3DotProduct(S, handle_edges(i + 2));
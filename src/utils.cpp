@@ -19,8 +19,9 @@ void DrawArrow(Particle* particle, Params* params) {
 
 // INITIALIZE THE PARTICLES
 // PARAMS: (reference to a vector of the particles), (pointer to simulation params)
-void InitParticles(std::vector<Particle>& particles, Params* params) {
-    particles.clear();
+void InitParticles(FirstTouchVector<Particle>& particles, Params* params) {
+    // a new array, so its first touch is partitioned over exactly n_of_particles sites
+    FirstTouchVector<Particle>(params->n_of_particles).swap(particles);
     float distance = 100.0f / params->n_of_particles;
 
     std::random_device rd;
@@ -39,8 +40,7 @@ void InitParticles(std::vector<Particle>& particles, Params* params) {
             sin(theta),
             0
         };
-        Particle particle = (Particle) {position, spin};
-        particles.push_back(particle);
+        particles[i] = (Particle) {position, spin};
     }
 
 }
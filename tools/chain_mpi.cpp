@@ -0,0 +1,443 @@
+#include <mpi.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <math.h>
+#include "raylib.h"
+#include "raymath.h"
+#include "utils.h"
+#include "DataLogger.h"
+#include "LiveExport.h"
+
+// Headless run of the 1D chain split into contiguous slices, one per MPI rank.
+// Every slice keeps two ghost sites on both sides (the reach of the J2 term). They are
+// refreshed before each half-step of the predictor-corrector integrator, and the
+// exchange is overlapped with the sites whose stencil stays inside the slice. The
+// dipolar term couples the whole chain and is not available in this mode.
+// Runs on one machine over MPI shared memory:
+//
+//   mpirun -np 4 ./build/chain_mpi -n 1000000 -o recording.bin
+//   mpirun -np 4 ./build/chain_mpi -n 1000 --verify 2000
+//
+// With --affinity compact|spread the OpenMP threads of every rank are pinned inside the cpus
+// the rank was bound to (mpirun --bind-to socket --map-by socket for one rank per socket).
+// With --live /name every rank publishes its slice to /name.<rank> (see live_monitor).
+// With --local-frame both deviations across the ground state spins are written, [t][e1, e2][site].
+// With --codec int16|float16 (and --tolerance, the largest error of an int16 value) every rank
+// writes its slice as it was compressed while recording, one record after the other.
+// With --spectrum <MB> rank 0 transforms the written file into result_big3.csv afterwards, out of
+// core in that much memory, so the recording can be larger than the memory of one node.
+// With --dispersion it also writes the peaks of every k to result_dispersion.csv.
+
+#define HALO 2
+
+struct Slice {
+    long offset; // global index of the first owned site
+    int n; // number of owned sites
+    long N; // number of sites in the whole chain
+    int rank;
+    int left; // rank owning the sites to the left (periodic)
+    int right;
+    bool open_ends; // no neighbours past the ends of the chain
+};
+
+struct Halo {
+    Vector3 send_left[HALO];
+    Vector3 send_right[HALO];
+    Vector3 recv_left[HALO];
+    Vector3 recv_right[HALO];
+    MPI_Request requests[4];
+};
+
+// The owned sites live at [HALO, n + HALO) of the local vectors, ghosts on both sides.
+
+// START THE HALO EXCHANGE OF A LOCAL VECTOR
+// PARAMS: (halo buffers), (local sites with ghosts), (slice description)
+void BeginHalo(Halo& halo, const FirstTouchVector<Particle>& local, Slice& slice) {
+    for (int k = 0; k < HALO; k++) {
+        halo.send_left[k] = local[HALO + k].spin;
+        halo.send_right[k] = local[slice.n + k].spin;
+    }
+    // tag 0 travels to the right, tag 1 to the left
+    MPI_Irecv(halo.recv_left, 3 * HALO, MPI_FLOAT, slice.left, 0, MPI_COMM_WORLD, &halo.requests[0]);
+    MPI_Irecv(halo.recv_right, 3 * HALO, MPI_FLOAT, slice.right, 1, MPI_COMM_WORLD, &halo.requests[1]);
+    MPI_Isend(halo.send_right, 3 * HALO, MPI_FLOAT, slice.right, 0, MPI_COMM_WORLD, &halo.requests[2]);
+    MPI_Isend(halo.send_left, 3 * HALO, MPI_FLOAT, slice.left, 1, MPI_COMM_WORLD, &halo.requests[3]);
+}
+
+// FINISH THE HALO EXCHANGE AND FILL THE GHOST SITES
+// PARAMS: (halo buffers), (local sites with ghosts), (slice description)
+void EndHalo(Halo& halo, FirstTouchVector<Particle>& local, Slice& slice) {
+    MPI_Waitall(4, halo.requests, MPI_STATUSES_IGNORE);
+    for (int k = 0; k < HALO; k++) {
+        local[k].spin = halo.recv_left[k];
+        local[slice.n + HALO + k].spin = halo.recv_right[k];
+    }
+    // a zero ghost drops the bond, as past the ends of the serial chain
+    if (slice.open_ends && slice.offset == 0) {
+        for (int k = 0; k < HALO; k++) local[k].spin = Vector3Zero();
+    }
+    if (slice.open_ends && slice.offset + slice.n == slice.N) {
+        for (int k = 0; k < HALO; k++) local[slice.n + HALO + k].spin = Vector3Zero();
+    }
+}
+
+// RUN ONE SWEEP OVER THE OWNED SITES WHILE THE GHOSTS OF src ARE EXCHANGED
+// PARAMS: (local vector whose ghosts the sweep reads), (slice description), (per-site update taking the local index)
+template <typename Site>
+void OverlappedSweep(FirstTouchVector<Particle>& src, Slice& slice, Site site) {
+    Halo halo;
+    BeginHalo(halo, src, slice);
+
+    // sites whose stencil only touches owned sites
+    int lo = 2 * HALO;
+    int hi = slice.n;
+	#pragma omp parallel for schedule(static)
+    for (int j = lo; j < hi; j++) {
+        site(j);
+    }
+
+    EndHalo(halo, src, slice);
+    int first_end = (lo < slice.n + HALO) ? lo : slice.n + HALO;
+    for (int j = HALO; j < first_end; j++) {
+        site(j);
+    }
+    for (int j = (hi > lo) ? hi : lo; j < slice.n + HALO; j++) {
+        site(j);
+    }
+}
+
+// INTEGRATOR FOR ONE SLICE, THE SAME SCHEME AS MinimizeEnergy
+// PARAMS: (local sites), (workspace vectors), (damping of the owned sites), (slice description), (pointer to simulation params)
+void StepSlice(FirstTouchVector<Particle>& local, FirstTouchVector<Particle>& predictions, FirstTouchVector<Vector3>& derivatives,
+               FirstTouchVector<Vector3>& new_spins, FirstTouchVector<Vector3>& thermal, const FirstTouchVector<float>& damping_profile,
+               Slice& slice, Params* params) {
+    float dt = params->dt_ps;
+
+    // the noise is keyed by the global site, so it doesn't depend on the number of ranks
+    if (params->thermal_on) {
+		#pragma omp parallel for schedule(static)
+        for (int j = HALO; j < slice.n + HALO; j++) {
+            thermal[j] = ThermalField(slice.offset + j - HALO, damping_profile[j - HALO], params);
+        }
+    }
+
+    auto field = [&](const FirstTouchVector<Particle>& v, int j) {
+        Vector3 H = ExchangeField(v[j - 2].spin, v[j - 1].spin, v[j + 1].spin, v[j + 2].spin, params);
+        H = Vector3Add(H, ZeemanField(v[j].pos, params));
+        return Vector3Add(H, thermal[j]);
+    };
+
+    // Predictor
+    OverlappedSweep(local, slice, [&](int j) {
+        Vector3 S = local[j].spin;
+        Vector3 dS = LLGDerivative(field(local, j), S, damping_profile[j - HALO], params);
+        derivatives[j] = dS;
+        predictions[j].spin = Vector3Normalize(Vector3Add(S, Vector3Scale(dS, dt)));
+    });
+
+    // Corrector
+    OverlappedSweep(predictions, slice, [&](int j) {
+        Vector3 S = predictions[j].spin;
+        Vector3 dS = LLGDerivative(field(predictions, j), S, damping_profile[j - HALO], params);
+        Vector3 avg = Vector3Scale(Vector3Add(derivatives[j], dS), 0.5f);
+        new_spins[j] = Vector3Normalize(Vector3Add(local[j].spin, Vector3Scale(avg, dt)));
+    });
+
+	#pragma omp parallel for schedule(static)
+    for (int j = HALO; j < slice.n + HALO; j++) {
+        local[j].spin = Vector3Normalize(new_spins[j]);
+    }
+    params->step_counter++;
+}
+
+// TOTAL ENERGY OF THE WHOLE CHAIN, SAME SUM AS getTotalEnergy
+// PARAMS: (local sites), (slice description), (pointer to simulation params)
+// RETURNS: the energy summed over all ranks
+double ChainEnergy(FirstTouchVector<Particle>& local, Slice& slice, Params* params) {
+    Halo halo;
+    BeginHalo(halo, local, slice);
+    EndHalo(halo, local, slice);
+
+    double result = 0.0;
+	#pragma omp parallel for schedule(static) reduction(+:result)
+    for (int j = HALO; j < slice.n + HALO; j++) {
+        Vector3 S = local[j].spin;
+        result += params->J1 * Vector3DotProduct(S, local[j + 1].spin);
+        result += params->J2 * Vector3DotProduct(S, local[j + 2].spin);
+        if (params->ext_field_on) {
+            result -= params->external_field * S.z;
+        }
+    }
+    double total = 0.0;
+    MPI_Allreduce(&result, &total, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    return total;
+}
+
+// RUN THE SERIAL INTEGRATOR ON RANK 0 AND COMPARE WITH THE DECOMPOSED CHAIN
+// PARAMS: (local sites after the run), (slice description), (steps that were run), (seed), (pointer to simulation params)
+// RETURNS: 0 if the chains agree
+int VerifySlices(FirstTouchVector<Particle>& local, Slice& slice, int steps, uint32_t seed, Params* params) {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    std::vector<float> mine(3 * slice.n);
+    for (int k = 0; k < slice.n; k++) {
+        mine[3 * k] = local[k + HALO].spin.x;
+        mine[3 * k + 1] = local[k + HALO].spin.y;
+        mine[3 * k + 2] = local[k + HALO].spin.z;
+    }
+    int count = 3 * slice.n;
+    std::vector<int> counts(size), displs(size);
+    MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    std::vector<float> all;
+    if (slice.rank == 0) {
+        for (int r = 1; r < size; r++) {
+            displs[r] = displs[r - 1] + counts[r - 1];
+        }
+        all.resize(3 * slice.N);
+    }
+    MPI_Gatherv(mine.data(), count, MPI_FLOAT, all.data(), counts.data(), displs.data(), MPI_FLOAT, 0, MPI_COMM_WORLD);
+    if (slice.rank != 0) {
+        return 0;
+    }
+
+    Params serial = *params;
+    serial.n_of_particles = (int) slice.N;
+    serial.step_counter = params->step_counter - steps;
+    FirstTouchVector<Particle> particles(slice.N);
+    for (long i = 0; i < slice.N; i++) {
+        particles[i] = InitialSite(i, slice.N, seed);
+    }
+    for (int step = 0; step < steps; step++) {
+        serial.ext_field_on = step < steps / 2;
+        MinimizeEnergy(particles, &serial);
+    }
+
+    float max_diff = 0.0f;
+    for (long i = 0; i < slice.N; i++) {
+        Vector3 S = { all[3 * i], all[3 * i + 1], all[3 * i + 2] };
+        float diff = Vector3Length(Vector3Subtract(S, particles[i].spin));
+        if (diff > max_diff) {
+            max_diff = diff;
+        }
+    }
+    printf("Max deviation from the serial integrator after %d steps on %d ranks: %g\n", steps, size, max_diff);
+    return (max_diff < 1e-4f) ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    Params params;
+    params.external_field = 1.5f;
+    long N = params.n_of_particles;
+    const char* output = "recording.bin";
+    int verify_steps = 0;
+    long max_relax_steps = 1000000;
+    const char* live_name = nullptr;
+    int affinity = AFFINITY_NONE;
+    int spectrum_mb = -1;
+    for (int a = 1; a < argc; a++) {
+        bool has_value = a + 1 < argc;
+        if (!strcmp(argv[a], "-n") && has_value) N = atol(argv[++a]);
+        else if (!strcmp(argv[a], "-o") && has_value) output = argv[++a];
+        else if (!strcmp(argv[a], "--J1") && has_value) params.J1 = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--J2") && has_value) params.J2 = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--field") && has_value) params.external_field = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--temperature") && has_value) {
+            params.temperature = atof(argv[++a]);
+            params.thermal_on = true;
+        }
+        else if (!strcmp(argv[a], "--energy-resolution") && has_value) params.energy_resolution = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--seed") && has_value) params.rng_seed = strtoul(argv[++a], nullptr, 10);
+        else if (!strcmp(argv[a], "--max-relax") && has_value) max_relax_steps = atol(argv[++a]);
+        else if (!strcmp(argv[a], "--verify") && has_value) verify_steps = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--open-ends")) params.open_ends = true;
+        else if (!strcmp(argv[a], "--local-frame")) params.local_frame_on = true;
+        else if (!strcmp(argv[a], "--spectrum") && has_value) spectrum_mb = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--dispersion")) params.dispersion_on = true;
+        else if (!strcmp(argv[a], "--codec") && has_value) {
+            a++;
+            params.snapshot_codec = !strcmp(argv[a], "int16") ? SNAPSHOT_INT16 : !strcmp(argv[a], "float16") ? SNAPSHOT_FLOAT16 : SNAPSHOT_FLOAT32;
+        }
+        else if (!strcmp(argv[a], "--tolerance") && has_value) params.snapshot_tolerance = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--live") && has_value) {
+            live_name = argv[++a];
+            params.live_export_on = true;
+        }
+        else if (!strcmp(argv[a], "--affinity") && has_value) {
+            a++;
+            affinity = !strcmp(argv[a], "compact") ? AFFINITY_COMPACT : !strcmp(argv[a], "spread") ? AFFINITY_SPREAD : AFFINITY_NONE;
+        }
+        else if (!strcmp(argv[a], "--live-interval") && has_value) params.live_export_interval_ps = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--absorber-width") && has_value) params.sponge_width = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--pml") && has_value) {
+            params.pml_reflection = atof(argv[++a]);
+            params.pml_on = true;
+        }
+        else {
+            if (rank == 0) {
+                fprintf(stderr, "Unknown argument %s\n", argv[a]);
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+
+    // Split the chain into contiguous slices
+    Slice slice;
+    slice.N = N;
+    slice.rank = rank;
+    slice.n = (int) (N / size + (rank < N % size ? 1 : 0));
+    slice.offset = rank * (N / size) + (rank < N % size ? rank : N % size);
+    slice.left = (rank - 1 + size) % size;
+    slice.right = (rank + 1) % size;
+    slice.open_ends = params.open_ends;
+    if (N / size < HALO) {
+        if (rank == 0) {
+            fprintf(stderr, "Every rank needs at least %d sites\n", HALO);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // Local sites, the positions of the ghosts are never used. The threads are pinned first,
+    // so the first touch puts every thread's part of the slice on its own socket.
+    PinThreads(affinity);
+    FirstTouchVector<Particle> local(slice.n + 2 * HALO);
+	#pragma omp parallel for schedule(static)
+    for (int k = 0; k < slice.n; k++) {
+        local[k + HALO] = InitialSite(slice.offset + k, N, params.rng_seed);
+    }
+    FirstTouchVector<Particle> predictions = local;
+    FirstTouchVector<Vector3> derivatives(local.size());
+    FirstTouchVector<Vector3> new_spins(local.size());
+    FirstTouchVector<Vector3> thermal(local.size(), Vector3Zero());
+    FirstTouchVector<float> damping_profile(slice.n);
+    auto update_damping = [&]() {
+        float peak_damping = AbsorberPeakDamping(&params);
+        for (int k = 0; k < slice.n; k++) {
+            damping_profile[k] = SpongeDamping(slice.offset + k, N, peak_damping, &params);
+        }
+    };
+    update_damping();
+
+    if (verify_steps > 0) {
+        for (int step = 0; step < verify_steps; step++) {
+            params.ext_field_on = step < verify_steps / 2;
+            StepSlice(local, predictions, derivatives, new_spins, thermal, damping_profile, slice, &params);
+        }
+        int result = VerifySlices(local, slice, verify_steps, params.rng_seed, &params);
+        MPI_Bcast(&result, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Finalize();
+        return result;
+    }
+
+    LiveExport live;
+    if (params.live_export_on) {
+        std::string name = std::string(live_name) + "." + std::to_string(rank);
+        live.open(name.c_str(), slice.n, slice.offset, N, 16, &params);
+    }
+
+    // STAGE 1: find the ground state
+    if (rank == 0) {
+        printf("Looking for ground state of %ld sites on %d ranks...\n", N, size);
+    }
+    double previous_energy = ChainEnergy(local, slice, &params);
+    float min_change = (N / 100000.0f) * 5;
+    for (long step = 1; step <= max_relax_steps; step++) {
+        StepSlice(local, predictions, derivatives, new_spins, thermal, damping_profile, slice, &params);
+        if (step % 100 == 0) {
+            double energy = ChainEnergy(local, slice, &params);
+            // same criterion as the GUI: ten steps worth of energy change
+            double change = fabs(energy - previous_energy) / 10.0;
+            previous_energy = energy;
+            if (live.due(step * params.dt_ps, &params)) {
+                live.publish(&local[HALO], step * params.dt_ps, energy, LIVE_RELAXING, &params);
+            }
+            if (rank == 0 && step % 10000 == 0) {
+                printf("Step %ld: E = %f meV, change %f (target %f)\n", step, energy, change, min_change);
+            }
+            if (change < min_change) {
+                break;
+            }
+        }
+    }
+
+    // STAGE 2: pulse and record
+    if (rank == 0) {
+        printf("Found ground state! Removed precession damping.\n");
+    }
+    params.damping = 0.00001f;
+    params.dt_ps = 0.001f;
+    update_damping();
+
+    FirstTouchVector<Particle> ground_state(local.begin() + HALO, local.begin() + HALO + slice.n);
+    Params local_params = params;
+    local_params.n_of_particles = slice.n;
+    float recording_time = (2 * M_PI * params.hbar) / params.energy_resolution;
+    int stride = DataLogger::recording_stride(&local_params);
+    DataLogger logger((size_t) (recording_time / (stride * params.dt_ps)) * slice.n, ground_state);
+    logger.plan_recording(&local_params);
+
+    float current_time = 0.0f;
+    float rec_start_time = params.ext_field_pulse_lenght + 20.0f;
+    float rec_end_time = rec_start_time + recording_time;
+    params.ext_field_on = true;
+    while (current_time < rec_end_time) {
+        if (params.ext_field_on && current_time > params.ext_field_pulse_lenght) {
+            params.ext_field_on = false;
+        }
+        StepSlice(local, predictions, derivatives, new_spins, thermal, damping_profile, slice, &params);
+        if (current_time >= rec_start_time) {
+            logger.record(&local[HALO], &local_params);
+        }
+        if (live.due(current_time, &params)) {
+            live.publish(&local[HALO], current_time, NAN, 0u, &params);
+        }
+        current_time += params.dt_ps;
+    }
+
+    // Every rank writes its own columns of the shared recording
+    if (rank == 0) {
+        FILE* file = fopen(output, "w");
+        if (file != nullptr) {
+            fclose(file);
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    // compressed slices follow each other in the order of the ranks
+    unsigned long long slice_bytes = logger.compressed_slice_bytes(), position = 0;
+    MPI_Exscan(&slice_bytes, &position, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        position = 0;
+    }
+    int ok = logger.write_slice(output, slice.offset, N, (size_t) position, &local_params) ? 1 : 0;
+    int all_ok = 0;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (rank == 0 && all_ok && params.snapshot_codec != SNAPSHOT_FLOAT32) {
+        printf("Wrote %s: %d compressed slices of %ld sites in all\n", output, size, N);
+    }
+    else if (rank == 0 && all_ok) {
+        printf("Wrote %s: float32 snapshots of %ld sites, row-major %s\n", output, N,
+               params.local_frame_on ? "[t][e1, e2][site]" : "[t][site]");
+    }
+    if (rank == 0 && all_ok && spectrum_mb >= 0) {
+        Params whole = params;
+        whole.n_of_particles = (int) N;
+        whole.analysis_memory_mb = spectrum_mb;
+        FirstTouchVector<Particle> no_sites;
+        DataLogger analysis(0, no_sites);
+        if (analysis.analyze_recording(output, &whole)) {
+            printf("Wrote the spectrum of %s to result_big3.csv\n", output);
+        }
+    }
+
+    MPI_Finalize();
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <math.h>
+#include <unistd.h>
+#include "LiveReader.h"
+
+// Watches a running simulation through its live export and prints one line per frame:
+// time, energy, mean spin and the largest deviation of S_z from the first frame seen.
+// Start the GUI with "Live export" ticked, or chain_mpi with --live, then
+//
+//   ./build/live_monitor                 (the GUI, /spinchain)
+//   ./build/live_monitor /chain.0        (rank 0 of chain_mpi --live /chain)
+
+int main(int argc, char** argv) {
+    const char* name = LIVE_DEFAULT_NAME;
+    int poll_ms = 50;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--poll") && a + 1 < argc) poll_ms = atoi(argv[++a]);
+        else if (argv[a][0] == '/') name = argv[a];
+        else {
+            fprintf(stderr, "Usage: %s [/name] [--poll ms]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    LiveReader reader;
+    while (!reader.open(name)) {
+        printf("Waiting for %s...\n", name);
+        sleep(1);
+    }
+    const LiveHeader* info = reader.info();
+    printf("%s: sites %lu to %lu of %lu, %u slots, J1 = %.3f, J2 = %.3f meV\n", name,
+           (unsigned long) info->first_site, (unsigned long) (info->first_site + info->n_sites - 1),
+           (unsigned long) info->total_sites, info->n_slots, info->J1, info->J2);
+    printf("frame,time_ps,energy_meV,m_x,m_y,m_z,max_dSz,field_mT,skipped\n");
+
+    long n = (long) info->n_sites;
+    float* reference = (float*) malloc(n * sizeof(float));
+    bool have_reference = false;
+    uint64_t last = 0;
+    while (reader.writer_alive()) {
+        LiveFrame frame;
+        if (!reader.next(last, &frame)) {
+            usleep(poll_ms * 1000);
+            continue;
+        }
+        // work on the spins in place, then check that the writer didn't get to them
+        float max_change = 0.0f;
+        for (long i = 0; i < n && have_reference; i++) {
+            max_change = fmaxf(max_change, fabsf(frame.spins[3 * i + 2] - reference[i]));
+        }
+        double time_ps = frame.slot->time_ps;
+        float energy = frame.slot->energy;
+        float m[3] = { frame.slot->magnetization[0], frame.slot->magnetization[1], frame.slot->magnetization[2] };
+        float field = frame.slot->external_field;
+        if (!have_reference) {
+            for (long i = 0; i < n; i++) {
+                reference[i] = frame.spins[3 * i + 2];
+            }
+        }
+        if (!reader.valid(frame)) {
+            continue; // overwritten while reading, take the next one
+        }
+        have_reference = true;
+        printf("%lu,%.3f,%.4f,%.5f,%.5f,%.5f,%.3e,%.2f,%lu\n", (unsigned long) frame.frame, time_ps, energy,
+               m[0], m[1], m[2], max_change, field, (unsigned long) (last ? frame.frame - last - 1 : 0));
+        fflush(stdout);
+        last = frame.frame;
+    }
+    printf("The simulation closed %s\n", name);
+    free(reference);
+    return 0;
+}
@@ -0,0 +1,330 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+#include <fftw3.h>
+#include "utils.h"
+#include "DataLogger.h"
+#include "Simulation.h"
+#include "ThreadPool.h"
+#include "GroundStateLibrary.h"
+
+// Headless parameter sweep. Every point goes through relaxation, pulse, recording and
+// analysis like a GUI run, scheduled as two tasks (run, then analysis) on a work-stealing
+// pool. Results go to <out>/job_NNNN/ with <out>/index.csv listing the parameters, and
+// jobs whose directory already has a "done" marker and the same params.txt are skipped.
+//
+//   ./build/sweep grid.txt results        one "key = value" per line, where the value can be
+//                                          a list "a, b, c" or a range "start:stop:count"
+//   ./build/sweep points.csv results      header of keys, one job per row
+//
+// With --library <dir> every run starts from the closest ground state relaxed so far and adds
+// its own when it is relaxed.
+
+typedef std::map<std::string, double> Point;
+
+// Parameters that can be swept
+static const std::map<std::string, std::function<void(Params&, double)>> setters = {
+    { "n_of_particles", [](Params& p, double v) { p.n_of_particles = (int) v; } },
+    { "J1", [](Params& p, double v) { p.J1 = v; } },
+    { "J2", [](Params& p, double v) { p.J2 = v; } },
+    { "external_field", [](Params& p, double v) { p.external_field = v; } },
+    { "external_field_radius", [](Params& p, double v) { p.external_field_radius = v; } },
+    { "ext_field_pulse_lenght", [](Params& p, double v) { p.ext_field_pulse_lenght = v; } },
+    { "ext_field_sigma", [](Params& p, double v) { p.ext_field_sigma = v; } },
+    { "damping", [](Params& p, double v) { p.damping = v; } },
+    { "sponge_width", [](Params& p, double v) { p.sponge_width = (int) v; } },
+    { "open_ends", [](Params& p, double v) { p.open_ends = v != 0.0; } },
+    { "pml_on", [](Params& p, double v) { p.pml_on = v != 0.0; } },
+    { "pml_reflection", [](Params& p, double v) { p.pml_reflection = v; } },
+    { "pml_order", [](Params& p, double v) { p.pml_order = (int) v; } },
+    { "multigrid_levels", [](Params& p, double v) { p.multigrid_levels = (int) v; } },
+    { "local_frame_on", [](Params& p, double v) { p.local_frame_on = v != 0.0; } },
+    { "analysis_memory_mb", [](Params& p, double v) { p.analysis_memory_mb = (int) v; } },
+    { "adaptive_on", [](Params& p, double v) { p.adaptive_on = v != 0.0; } },
+    { "spin_tolerance", [](Params& p, double v) { p.spin_tolerance = v; } },
+    { "energy_resolution", [](Params& p, double v) { p.energy_resolution = v; } },
+    { "window_param", [](Params& p, double v) { p.window_param = v; } },
+    { "max_energy", [](Params& p, double v) { p.max_energy = v; } },
+    { "decimation_order", [](Params& p, double v) { p.decimation_order = (int) v; } },
+    { "welch_segments", [](Params& p, double v) { p.welch_segments = (int) v; } },
+    { "welch_overlap", [](Params& p, double v) { p.welch_overlap = v; } },
+    { "pulse_repeats", [](Params& p, double v) { p.pulse_repeats = (int) v; } },
+    { "snapshot_codec", [](Params& p, double v) { p.snapshot_codec = (int) v; } },
+    { "snapshot_tolerance", [](Params& p, double v) { p.snapshot_tolerance = (float) v; } },
+    { "zoom_on", [](Params& p, double v) { p.zoom_on = v != 0.0; } },
+    { "zoom_k_min", [](Params& p, double v) { p.zoom_k_min = (float) v; } },
+    { "zoom_k_max", [](Params& p, double v) { p.zoom_k_max = (float) v; } },
+    { "zoom_energy_min", [](Params& p, double v) { p.zoom_energy_min = (float) v; } },
+    { "zoom_energy_max", [](Params& p, double v) { p.zoom_energy_max = (float) v; } },
+    { "zoom_rows", [](Params& p, double v) { p.zoom_rows = (int) v; } },
+    { "zoom_ar_order", [](Params& p, double v) { p.zoom_ar_order = (int) v; } },
+    { "dispersion_on", [](Params& p, double v) { p.dispersion_on = v != 0.0; } },
+    { "dispersion_sigma_energy", [](Params& p, double v) { p.dispersion_sigma_energy = (float) v; } },
+    { "dispersion_sigma_k", [](Params& p, double v) { p.dispersion_sigma_k = (float) v; } },
+    { "dispersion_floor", [](Params& p, double v) { p.dispersion_floor = (float) v; } },
+    { "dispersion_threshold", [](Params& p, double v) { p.dispersion_threshold = (float) v; } },
+    { "dispersion_peaks", [](Params& p, double v) { p.dispersion_peaks = (int) v; } },
+    { "dipolar_on", [](Params& p, double v) { p.dipolar_on = v != 0.0; } },
+    { "dipolar_D", [](Params& p, double v) { p.dipolar_D = v; } },
+    { "thermal_on", [](Params& p, double v) { p.thermal_on = v != 0.0; } },
+    { "temperature", [](Params& p, double v) { p.temperature = v; } },
+    { "rng_seed", [](Params& p, double v) { p.rng_seed = (uint32_t) v; } },
+};
+
+static std::string Trim(const std::string& text) {
+    size_t first = text.find_first_not_of(" \t\r");
+    size_t last = text.find_last_not_of(" \t\r");
+    return (first == std::string::npos) ? "" : text.substr(first, last - first + 1);
+}
+
+// VALUES OF ONE GRID LINE: "a", "a, b, c" or "start:stop:count"
+static std::vector<double> ParseValues(const std::string& text) {
+    std::vector<double> values;
+    if (text.find(':') != std::string::npos) {
+        double start, stop;
+        int count;
+        if (sscanf(text.c_str(), "%lf:%lf:%d", &start, &stop, &count) == 3 && count > 0) {
+            for (int i = 0; i < count; i++) {
+                values.push_back(count == 1 ? start : start + (stop - start) * i / (count - 1));
+            }
+        }
+        return values;
+    }
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        if (!Trim(item).empty()) {
+            values.push_back(atof(item.c_str()));
+        }
+    }
+    return values;
+}
+
+// READ THE POINTS OF A GRID FILE (CARTESIAN PRODUCT) OR A CSV LIST
+// PARAMS: (path), (output: swept keys in file order), (output points)
+// RETURNS: false if the file couldn't be read or has unknown keys
+static bool ReadPoints(const char* path, std::vector<std::string>& keys, std::vector<Point>& points) {
+    std::ifstream file(path);
+    if (!file) {
+        perror("Couldn't open the sweep file");
+        return false;
+    }
+    std::string line;
+    bool csv = strlen(path) > 4 && !strcmp(path + strlen(path) - 4, ".csv");
+    if (csv) {
+        if (!std::getline(file, line)) {
+            return false;
+        }
+        std::stringstream header(line);
+        std::string key;
+        while (std::getline(header, key, ',')) {
+            keys.push_back(Trim(key));
+        }
+        while (std::getline(file, line)) {
+            if (Trim(line).empty()) continue;
+            std::vector<double> values = ParseValues(line);
+            if (values.size() != keys.size()) {
+                fprintf(stderr, "Row with %zu values for %zu keys: %s\n", values.size(), keys.size(), line.c_str());
+                return false;
+            }
+            Point point;
+            for (size_t k = 0; k < keys.size(); k++) {
+                point[keys[k]] = values[k];
+            }
+            points.push_back(point);
+        }
+    }
+    else {
+        std::vector<std::vector<double>> axes;
+        while (std::getline(file, line)) {
+            line = Trim(line.substr(0, line.find('#')));
+            size_t equals = line.find('=');
+            if (line.empty() || equals == std::string::npos) continue;
+            keys.push_back(Trim(line.substr(0, equals)));
+            axes.push_back(ParseValues(line.substr(equals + 1)));
+            if (axes.back().empty()) {
+                fprintf(stderr, "No values for %s\n", keys.back().c_str());
+                return false;
+            }
+        }
+        // Cartesian product, the last key varies fastest
+        points.push_back(Point());
+        for (size_t k = 0; k < keys.size(); k++) {
+            std::vector<Point> expanded;
+            for (const Point& point : points) {
+                for (double value : axes[k]) {
+                    Point next = point;
+                    next[keys[k]] = value;
+                    expanded.push_back(next);
+                }
+            }
+            points.swap(expanded);
+        }
+    }
+    for (const std::string& key : keys) {
+        if (setters.find(key) == setters.end()) {
+            fprintf(stderr, "Unknown parameter %s\n", key.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool Exists(const std::string& path) {
+    return access(path.c_str(), F_OK) == 0;
+}
+
+// SHORTEST TEXT OF A VALUE THAT READS BACK AS THE SAME DOUBLE
+static std::string ExactValue(double value) {
+    char text[32];
+    for (int digits = 6; digits <= 17; digits++) {
+        snprintf(text, sizeof(text), "%.*g", digits, value);
+        if (strtod(text, nullptr) == value) break;
+    }
+    return text;
+}
+
+// "key = value" LINES OF A POINT, AS IN params.txt
+static std::string ParamsText(const Point& point) {
+    std::string text;
+    for (const auto& entry : point) {
+        text += entry.first + " = " + ExactValue(entry.second) + "\n";
+    }
+    return text;
+}
+
+// WHOLE FILE AS A STRING, EMPTY IF IT CAN'T BE READ
+static std::string ReadText(const std::string& path) {
+    std::ifstream file(path);
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <grid.txt|points.csv> <results dir> [-j workers] [--max-relax steps] [--library dir]\n", argv[0]);
+        return 1;
+    }
+    int cores = (int) std::thread::hardware_concurrency();
+    if (cores < 1) cores = 1;
+    int workers = cores;
+    long max_relax_steps = 1000000;
+    const char* library_dir = nullptr;
+    for (int a = 3; a < argc; a++) {
+        if (!strcmp(argv[a], "-j") && a + 1 < argc) workers = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--max-relax") && a + 1 < argc) max_relax_steps = atol(argv[++a]);
+        else if (!strcmp(argv[a], "--library") && a + 1 < argc) library_dir = argv[++a];
+    }
+
+    std::vector<std::string> keys;
+    std::vector<Point> points;
+    if (!ReadPoints(argv[1], keys, points)) {
+        return 1;
+    }
+    std::string out = argv[2];
+    mkdir(out.c_str(), 0755);
+
+    // Index of all jobs
+    FILE* index = fopen((out + "/index.csv").c_str(), "w");
+    if (index == nullptr) {
+        perror("Couldn't create index.csv");
+        return 1;
+    }
+    fprintf(index, "job");
+    for (const std::string& key : keys) fprintf(index, ",%s", key.c_str());
+    fprintf(index, "\n");
+    for (size_t j = 0; j < points.size(); j++) {
+        fprintf(index, "job_%04zu", j);
+        for (const std::string& key : keys) fprintf(index, ",%g", points[j].at(key));
+        fprintf(index, "\n");
+    }
+    fclose(index);
+
+    GroundStateLibrary* library = (library_dir != nullptr) ? new GroundStateLibrary(library_dir) : nullptr;
+    fftwf_make_planner_thread_safe();
+    ThreadPool pool(workers);
+    int skipped = 0;
+    for (size_t j = 0; j < points.size(); j++) {
+        char name[32];
+        snprintf(name, sizeof(name), "/job_%04zu", j);
+        std::string dir = out + name;
+        // the index of a job changes when the grid is edited, its parameters don't
+        std::string text = ParamsText(points[j]);
+        if (Exists(dir + "/done")) {
+            if (ReadText(dir + "/params.txt") == text) {
+                skipped++;
+                continue;
+            }
+            printf("%s: was done for other parameters, running again\n", dir.c_str());
+            unlink((dir + "/done").c_str());
+        }
+        mkdir(dir.c_str(), 0755);
+
+        Params params;
+        for (const auto& entry : points[j]) {
+            setters.at(entry.first)(params, entry.second);
+        }
+        FILE* values = fopen((dir + "/params.txt").c_str(), "w");
+        if (values != nullptr) {
+            fputs(text.c_str(), values);
+            fclose(values);
+        }
+
+        pool.submit([&pool, &cores, library, params, dir, max_relax_steps]() mutable {
+            // share the cores between the jobs that are left
+            long jobs = pool.pending();
+            long sharing = (jobs < pool.size()) ? jobs : pool.size();
+            omp_set_num_threads((int) ((sharing > 0 && cores / sharing > 1) ? cores / sharing : 1));
+
+            FirstTouchVector<Particle> particles(params.n_of_particles);
+            bool warm = library != nullptr && library->warm_start(particles, &params);
+            // a stored ground state has no long-wavelength defects for the coarse levels to remove
+            long coarse_steps = 0;
+            if (!warm) {
+                for (int i = 0; i < params.n_of_particles; i++) {
+                    particles[i] = InitialSite(i, params.n_of_particles, params.rng_seed);
+                }
+                coarse_steps = CoarseToFine(particles, &params, max_relax_steps);
+            }
+            bool converged;
+            long steps = coarse_steps + RelaxGroundState(particles, &params, max_relax_steps - coarse_steps, &converged);
+            printf("%s: ground state after %ld steps%s\n", dir.c_str(), steps, converged ? "" : " (not converged)");
+            // an unrelaxed chain would be a bad start for the runs after it
+            if (library != nullptr && converged) {
+                library->store(particles, &params);
+            }
+            DataLogger* logger = RecordPulse(particles, &params);
+            if (logger == nullptr) {
+                printf("%s: couldn't plan the segments\n", dir.c_str());
+                return;
+            }
+            logger->set_output_dir(dir);
+
+            // the analysis runs as its own task, usually next on this worker
+            pool.submit([params, dir, logger]() mutable {
+                logger->analyze(&params);
+                delete logger;
+                FILE* marker = fopen((dir + "/done").c_str(), "w");
+                if (marker != nullptr) {
+                    fclose(marker);
+                }
+                printf("%s: done\n", dir.c_str());
+            });
+        });
+    }
+    printf("%zu jobs, %d already done, %d workers on %d cores\n", points.size(), skipped, pool.size(), cores);
+    pool.wait();
+    delete library;
+    return 0;
+}